@@ -0,0 +1,754 @@
+#include "engine.h"
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <algorithm>
+#ifdef ARDUINO
+#include <esp_rom_crc.h>
+#endif
+
+std::vector<Checkpoint> g_checkpoints;
+std::vector<Team> g_teams;
+
+// ------------------ utils ------------------
+
+bool consttime_eq(const String& a, const String& b) {
+  return consttime_eq(a.c_str(), a.length(), b.c_str(), b.length());
+}
+
+bool consttime_eq(const char* a, size_t la, const char* b, size_t lb) {
+  size_t l = (la>lb)?la:lb;
+  uint8_t diff = 0;
+  for (size_t i=0;i<l;i++) {
+    char ca = (i<la)?a[i]:0;
+    char cb = (i<lb)?b[i]:0;
+    diff |= (ca ^ cb);
+  }
+  return diff == 0 && la == lb;
+}
+
+uint32_t fnv1a(const char* s, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) { h ^= (uint8_t)s[i]; h *= 16777619u; }
+  return h;
+}
+
+// Standard CRC-32 (zlib); the ROM routine on the board, bitwise on the host
+uint32_t snapshotCrc32(const uint8_t* p, size_t n) {
+#ifdef ARDUINO
+  return esp_rom_crc32_le(0, p, n);
+#else
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; i++) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+#endif
+}
+
+// slot -> index into g_checkpoints (-1 when the slot is free)
+static int16_t g_slotToCheckpoint[MAX_CHECKPOINTS];
+
+void updatePointsFromFound(Team& t) {
+  int pts = 0;
+  for (int wi = 0; wi < MAX_CHECKPOINTS / 32; wi++) {
+    uint32_t bits = t.found.w[wi];
+    while (bits) {
+      int slot = (wi << 5) | __builtin_ctz(bits);
+      bits &= bits - 1;
+      int16_t ci = g_slotToCheckpoint[slot];
+      if (ci >= 0) pts += g_checkpoints[ci].points;
+    }
+  }
+  t.points = pts;
+}
+
+uint32_t g_checkpointsDigest = 0;
+
+static uint32_t fnv1aMix(uint32_t h, const void* p, size_t n) {
+  const uint8_t* b = (const uint8_t*)p;
+  for (size_t i = 0; i < n; i++) { h ^= b[i]; h *= 16777619u; }
+  return h;
+}
+
+// Rebuild everything derived from g_checkpoints (slot table, token index, digest).
+void reindexCheckpoints() {
+  for (int i = 0; i < MAX_CHECKPOINTS; i++) g_slotToCheckpoint[i] = -1;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < g_checkpoints.size(); i++) {
+    const Checkpoint &c = g_checkpoints[i];
+    if (c.slot < MAX_CHECKPOINTS) g_slotToCheckpoint[c.slot] = (int16_t)i;
+    // Content only: slots are reassigned on every load, and the codeword is
+    // left out because the digest is public (ETag) and would let it be guessed
+    // offline. NUL separators keep ("ab","c") and ("a","bc") apart.
+    h = fnv1aMix(h, c.id.c_str(), c.id.length() + 1);
+    h = fnv1aMix(h, c.name.c_str(), c.name.length() + 1);
+    h = fnv1aMix(h, &c.points, sizeof(c.points));
+  }
+  g_checkpointsDigest = h;
+  rebuildTokenIndex();
+}
+
+Checkpoint* findCheckpointBySlot(uint16_t slot) {
+  if (slot >= MAX_CHECKPOINTS || g_slotToCheckpoint[slot] < 0) return nullptr;
+  return &g_checkpoints[g_slotToCheckpoint[slot]];
+}
+
+void replaceCheckpoints(std::vector<Checkpoint>& next) {
+  bool used[MAX_CHECKPOINTS] = {false};
+  for (auto &c : next) {
+    c.slot = NO_SLOT;
+    Checkpoint* prev = findCheckpointById(c.id);
+    if (prev && prev->slot < MAX_CHECKPOINTS && !used[prev->slot]) {
+      c.slot = prev->slot;
+      used[c.slot] = true;
+    }
+  }
+  // Slots that disappeared must not leak into a new checkpoint, which may get
+  // one of them below: clear them before handing any out
+  for (auto &c : g_checkpoints) {
+    if (c.slot < MAX_CHECKPOINTS && !used[c.slot]) for (auto &t : g_teams) t.found.clear(c.slot);
+  }
+  uint16_t freeSlot = 0;
+  for (auto &c : next) {
+    if (c.slot != NO_SLOT) continue;
+    while (used[freeSlot]) freeSlot++;
+    c.slot = freeSlot; used[freeSlot] = true;
+  }
+  g_checkpoints.swap(next);
+  reindexCheckpoints();
+  // Checkpoint points may have changed: rescore every team once here
+  for (auto &t : g_teams) updatePointsFromFound(t);
+  rebuildRanking();
+}
+
+// ------------------ Hash indexes ------------------
+// Open-addressed tables of (hash, index) with linear probing, sized to a power
+// of two at least twice the entry count. Callers compare the key behind a
+// matching hash themselves.
+
+struct TokenSlot {
+  uint32_t hash = 0;
+  int16_t  idx  = -1;   // -1 => empty
+};
+
+static size_t indexCapacity(size_t n) {
+  size_t cap = 16;
+  while (cap < n * 2) cap <<= 1;
+  return cap;
+}
+
+static void indexInsert(std::vector<TokenSlot>& tab, uint32_t h, size_t idx) {
+  size_t mask = tab.size() - 1;
+  size_t p = h & mask;
+  while (tab[p].idx >= 0) p = (p + 1) & mask;
+  tab[p].hash = h;
+  tab[p].idx  = (int16_t)idx;
+}
+
+// Index whose key(idx) equals s[0..n), or -1
+template <typename KeyFn>
+static int indexFind(const std::vector<TokenSlot>& tab, const char* s, size_t n, KeyFn key) {
+  if (tab.empty()) return -1;
+  uint32_t h = fnv1a(s, n);
+  size_t mask = tab.size() - 1;
+  for (size_t p = h & mask; tab[p].idx >= 0; p = (p + 1) & mask) {
+    if (tab[p].hash != h) continue;
+    const String& k = key(tab[p].idx);
+    if (k.length() == n && memcmp(k.c_str(), s, n) == 0) return tab[p].idx;
+  }
+  return -1;
+}
+
+// ------------------ Token index ------------------
+// Case-folded token -> index into g_checkpoints, plus id -> index. Rebuilt
+// whenever g_checkpoints changes; token lookups hash a stack copy of the
+// query and only run consttime_eq against the candidate with the same hash.
+
+static std::vector<TokenSlot> g_tokenIndex;
+static std::vector<TokenSlot> g_checkpointIdIndex;   // id -> index into g_checkpoints
+
+// Trim + ASCII lowercase into out[TOKEN_MAXLEN+1]; returns length, or -1 if too long.
+static int foldToken(const char* in, size_t len, char* out) {
+  size_t a = 0, b = len;
+  while (a < b && isspace((unsigned char)in[a])) a++;
+  while (b > a && isspace((unsigned char)in[b-1])) b--;
+  if (b - a > TOKEN_MAXLEN) return -1;
+  size_t n = 0;
+  for (size_t i = a; i < b; i++) out[n++] = (char)tolower((unsigned char)in[i]);
+  out[n] = 0;
+  return (int)n;
+}
+
+void rebuildTokenIndex() {
+  size_t cap = indexCapacity(g_checkpoints.size());
+  g_tokenIndex.assign(cap, TokenSlot());
+  g_checkpointIdIndex.assign(cap, TokenSlot());
+  for (size_t i = 0; i < g_checkpoints.size(); i++) {
+    const String& id = g_checkpoints[i].id;
+    indexInsert(g_checkpointIdIndex, fnv1a(id.c_str(), id.length()), i);
+  }
+  char key[TOKEN_MAXLEN + 1];
+  for (size_t i = 0; i < g_checkpoints.size(); i++) {
+    Checkpoint &c = g_checkpoints[i];
+    int n = foldToken(c.token_text.c_str(), c.token_text.length(), key);
+    if (n <= 0) { c.token_key = ""; continue; }
+    c.token_key = key;
+    uint32_t h = fnv1a(key, n);
+    size_t p = h & (cap - 1);
+    bool dup = false;
+    while (g_tokenIndex[p].idx >= 0) {
+      const TokenSlot &e = g_tokenIndex[p];
+      if (e.hash == h && g_checkpoints[e.idx].token_key == c.token_key) { dup = true; break; }
+      p = (p + 1) & (cap - 1);
+    }
+    if (dup) continue;  // first checkpoint with a given codeword wins
+    g_tokenIndex[p].hash = h;
+    g_tokenIndex[p].idx  = (int16_t)i;
+  }
+}
+
+bool saneCheckpointId(const String& id) {
+  if (id.length() < 1 || id.length() > ID_MAXLEN) return false;
+  for (size_t i = 0; i < id.length(); i++) {
+    char c = id[i];
+    bool ok = (c >= 'A' && c <= 'Z') ||
+              (c >= 'a' && c <= 'z') ||
+              (c >= '0' && c <= '9') ||
+              c == '-' || c == '_' || c == '.';
+    if (!ok) return false;
+  }
+  return true;
+}
+
+bool checkpointUnique(const std::vector<Checkpoint>& table, Checkpoint& c) {
+  char key[TOKEN_MAXLEN + 1];
+  int n = foldToken(c.token_text.c_str(), c.token_text.length(), key);
+  if (n <= 0) return false;
+  c.token_key = key;
+  for (auto &o : table) {
+    if (o.id == c.id || o.token_key == c.token_key) return false;
+  }
+  return true;
+}
+
+// Case-insensitive, allocation-free lookup.
+Checkpoint* findCheckpointByToken(const String& token) {
+  return findCheckpointByToken(token.c_str(), token.length());
+}
+Checkpoint* findCheckpointByToken(const char* token, size_t len) {
+  if (g_tokenIndex.empty()) return nullptr;
+  char key[TOKEN_MAXLEN + 1];
+  int n = foldToken(token, len, key);
+  if (n <= 0) return nullptr;
+  uint32_t h = fnv1a(key, n);
+  size_t mask = g_tokenIndex.size() - 1;
+  for (size_t p = h & mask; g_tokenIndex[p].idx >= 0; p = (p + 1) & mask) {
+    const TokenSlot &e = g_tokenIndex[p];
+    if (e.hash != h) continue;
+    Checkpoint &c = g_checkpoints[e.idx];
+    if (consttime_eq(c.token_key.c_str(), c.token_key.length(), key, n)) return &c;
+  }
+  return nullptr;
+}
+Checkpoint* findCheckpointById(const String& id) {
+  int i = indexFind(g_checkpointIdIndex, id.c_str(), id.length(),
+                    [](int16_t ix) -> const String& { return g_checkpoints[ix].id; });
+  return i < 0 ? nullptr : &g_checkpoints[i];
+}
+
+// ------------------ Team index ------------------
+// id -> index and name -> index into g_teams, the same numbering g_rank uses.
+// Appends are indexed in place by teamIndexAdd(); anything that removes or
+// reorders teams calls rebuildTeamIndex(). As a backstop, a lookup rebuilds
+// when the tables don't cover exactly g_teams.size() entries.
+
+static std::vector<TokenSlot> g_teamIdIndex;
+static std::vector<TokenSlot> g_teamNameIndex;
+static size_t g_teamIndexCount = 0;
+uint32_t g_teamsLayoutVersion = 1;
+
+static void teamIndexInsert(size_t i) {
+  const Team &t = g_teams[i];
+  indexInsert(g_teamIdIndex, fnv1a(t.id.c_str(), t.id.length()), i);
+  indexInsert(g_teamNameIndex, fnv1a(t.name.c_str(), t.name.length()), i);
+}
+
+void rebuildTeamIndex() {
+  size_t cap = indexCapacity(g_teams.size());
+  g_teamIdIndex.assign(cap, TokenSlot());
+  g_teamNameIndex.assign(cap, TokenSlot());
+  for (size_t i = 0; i < g_teams.size(); i++) teamIndexInsert(i);
+  g_teamIndexCount = g_teams.size();
+  g_teamsLayoutVersion++;
+}
+
+void teamIndexAdd(size_t idx) {
+  if (idx != g_teamIndexCount || (g_teamIndexCount + 1) * 2 > g_teamIdIndex.size()) {
+    rebuildTeamIndex();   // out of step, or past half full
+    return;
+  }
+  teamIndexInsert(idx);
+  g_teamIndexCount++;
+}
+
+static inline void teamIndexCheck() {
+  if (g_teamIndexCount != g_teams.size()) rebuildTeamIndex();
+}
+
+Team* findTeamById(const String& id) {
+  return findTeamById(id.c_str());
+}
+Team* findTeamById(const char* id) {
+  teamIndexCheck();
+  int i = indexFind(g_teamIdIndex, id, strlen(id),
+                    [](int16_t ix) -> const String& { return g_teams[ix].id; });
+  return i < 0 ? nullptr : &g_teams[i];
+}
+Team* findTeamByName(const String& nm) {
+  teamIndexCheck();
+  int i = indexFind(g_teamNameIndex, nm.c_str(), nm.length(),
+                    [](int16_t ix) -> const String& { return g_teams[ix].name; });
+  return i < 0 ? nullptr : &g_teams[i];
+}
+
+bool teamFoundHas(const Team& t, const Checkpoint& c) {
+  return t.found.has(c.slot);
+}
+
+bool teamAddFound(Team& t, const Checkpoint& c) {
+  if (teamFoundHas(t, c)) return false;
+  uint16_t n = (uint16_t)t.found.count();
+  if (t.recent_from == NO_SLOT) t.recent_from = n;
+  t.recent[n % RECENT_FINDS] = c.slot;
+  t.found.set(c.slot);
+  t.points += c.points;  // kept in sync; full recompute only when checkpoint points change
+  rankTeamScored(&t - g_teams.data());
+  return true;
+}
+
+int teamFindsSince(const Team& t, int since, uint16_t* out) {
+  int n = t.found.count();
+  if (since < 0 || since > n) return -1;
+  if (since == n) return 0;
+  if (t.recent_from == NO_SLOT || since < t.recent_from || n - since > RECENT_FINDS) return -1;
+  int k = 0;
+  for (int i = since; i < n; i++) {
+    uint16_t slot = t.recent[i % RECENT_FINDS];
+    if (!t.found.has(slot)) return -1;   // bits cleared since (checkpoint removed)
+    out[k++] = slot;
+  }
+  return k;
+}
+
+// ------------------ Leaderboard ranking ------------------
+// g_rank holds g_teams indices best-first and g_rankPos is its inverse, so a
+// find moves one entry from where it is: forward for the usual positive
+// award, backward in case a checkpoint ever carries negative points (the
+// admin paths refuse those, older saved tables may not).
+
+static std::vector<uint16_t> g_rank;
+static std::vector<uint16_t> g_rankPos;   // g_teams index -> position in g_rank
+uint32_t g_leaderboardVersion = 1;
+
+static void markLeaderboardChanged() {
+  g_leaderboardVersion++;
+}
+
+static bool rankBefore(const Team& a, const Team& b) {
+  if (a.points != b.points) return a.points > b.points;
+  return a.created_at < b.created_at;
+}
+
+void rebuildRanking() {
+  g_rank.resize(g_teams.size());
+  for (size_t i = 0; i < g_rank.size(); i++) g_rank[i] = (uint16_t)i;
+  std::stable_sort(g_rank.begin(), g_rank.end(), [](uint16_t a, uint16_t b){
+    return rankBefore(g_teams[a], g_teams[b]);
+  });
+  g_rankPos.resize(g_rank.size());
+  for (size_t i = 0; i < g_rank.size(); i++) g_rankPos[g_rank[i]] = (uint16_t)i;
+  markLeaderboardChanged();
+}
+
+static void rankSwap(size_t a, size_t b) {
+  std::swap(g_rank[a], g_rank[b]);
+  g_rankPos[g_rank[a]] = (uint16_t)a;
+  g_rankPos[g_rank[b]] = (uint16_t)b;
+}
+
+// Move g_rank[pos] forward while it outranks its predecessor.
+static size_t rankBubbleUp(size_t pos) {
+  while (pos > 0 && rankBefore(g_teams[g_rank[pos]], g_teams[g_rank[pos-1]])) {
+    rankSwap(pos, pos - 1);
+    pos--;
+  }
+  return pos;
+}
+
+// Move g_rank[pos] back while its successor outranks it.
+static size_t rankBubbleDown(size_t pos) {
+  while (pos + 1 < g_rank.size() && rankBefore(g_teams[g_rank[pos+1]], g_teams[g_rank[pos]])) {
+    rankSwap(pos, pos + 1);
+    pos++;
+  }
+  return pos;
+}
+
+void rankTeamAdded(size_t idx) {
+  if (g_rank.size() != idx) { rebuildRanking(); return; }
+  g_rank.push_back((uint16_t)idx);
+  g_rankPos.push_back((uint16_t)idx);
+  if (rankBubbleUp(g_rank.size() - 1) < LEADERBOARD_SIZE) markLeaderboardChanged();
+}
+
+void rankTeamScored(size_t idx) {
+  if (g_rank.size() != g_teams.size() || idx >= g_rankPos.size()) { rebuildRanking(); return; }
+  size_t from = g_rankPos[idx];
+  size_t to = rankBubbleUp(from);
+  if (to == from) to = rankBubbleDown(from);
+  // The top list changed if the team was or is on it (its own score moved)
+  if (from < LEADERBOARD_SIZE || to < LEADERBOARD_SIZE) markLeaderboardChanged();
+}
+
+void leaderboardToJson(JsonArray arr) {
+  for (size_t i = 0; i < g_rank.size() && i < LEADERBOARD_SIZE; i++) {
+    const Team &t = g_teams[g_rank[i]];
+    JsonObject o = arr.add<JsonObject>();
+    o["name"]=t.name.c_str(); o["points"]=t.points; o["found"]= t.found.count();
+  }
+}
+
+const std::vector<uint16_t>& teamRanking() {
+  if (g_rank.size() != g_teams.size()) rebuildRanking();
+  return g_rank;
+}
+
+// ------------------ Name order ------------------
+// Sorted on first use after a rebuild; registrations in between are inserted
+// by binary search, so a refresh after a handful of sign-ups costs a memmove.
+
+static std::vector<uint16_t> g_nameOrder;
+static uint32_t g_nameOrderLayout = 0;
+
+static bool nameBefore(uint16_t a, uint16_t b) {
+  int c = strcasecmp(g_teams[a].name.c_str(), g_teams[b].name.c_str());
+  return c != 0 ? c < 0 : a < b;
+}
+
+const std::vector<uint16_t>& teamsByName() {
+  if (g_nameOrderLayout != g_teamsLayoutVersion || g_nameOrder.size() > g_teams.size()) {
+    g_nameOrder.resize(g_teams.size());
+    for (size_t i = 0; i < g_nameOrder.size(); i++) g_nameOrder[i] = (uint16_t)i;
+    std::sort(g_nameOrder.begin(), g_nameOrder.end(), nameBefore);
+    g_nameOrderLayout = g_teamsLayoutVersion;
+  }
+  // appended since the last call: indices [size, g_teams.size())
+  for (size_t i = g_nameOrder.size(); i < g_teams.size(); i++) {
+    auto at = std::upper_bound(g_nameOrder.begin(), g_nameOrder.end(), (uint16_t)i, nameBefore);
+    g_nameOrder.insert(at, (uint16_t)i);
+  }
+  return g_nameOrder;
+}
+
+// ------------------ Bulk import ------------------
+
+const char* const CSV_COLUMNS[COL_COUNT] = { "id", "name", "token_text", "points" };
+
+// Split a CSV line in place (RFC 4180 quoting); returns the field count.
+static int splitCsv(char* s, size_t len, char** fields, int maxFields) {
+  int n = 0;
+  size_t i = 0;
+  while (n < maxFields) {
+    char* out = s + i;
+    fields[n++] = out;
+    size_t w = 0;
+    if (i < len && s[i] == '"') {
+      i++;
+      while (i < len) {
+        if (s[i] == '"') {
+          if (i + 1 < len && s[i+1] == '"') { out[w++] = '"'; i += 2; continue; }
+          i++; break;
+        }
+        out[w++] = s[i++];
+      }
+      while (i < len && s[i] != ',') i++;   // junk after the closing quote
+    } else {
+      while (i < len && s[i] != ',') out[w++] = s[i++];
+    }
+    bool more = i < len;
+    out[w] = 0;                             // overwrites the ',' (or sits at len)
+    if (!more) break;
+    i++;
+  }
+  return n;
+}
+
+static void rejectImportLine(CheckpointImport& im) {
+  im.rejected++;
+  if (!im.firstRejected) im.firstRejected = im.lineNo;
+}
+
+static void importLine(CheckpointImport& im, JsonDocument& scratch) {
+  im.lineNo++;
+  bool overflow = im.overflow;
+  size_t len = im.lineLen;
+  im.lineLen = 0; im.overflow = false;
+  if (overflow) { im.seenRecord = true; rejectImportLine(im); return; }
+  size_t a = 0;
+  while (a < len && isspace((unsigned char)im.line[a])) a++;
+  if (a == len) return;                     // blank line
+  bool first = !im.seenRecord;
+  im.seenRecord = true;
+  im.line[len] = 0;
+  char* rec = im.line + a;
+  len -= a;
+
+  Checkpoint c;
+  bool ok = false;
+  if (im.fmt == BULK_NDJSON) {
+    if (!deserializeJson(scratch, rec, len) && scratch.is<JsonObject>()) {
+      ok = im.make(scratch["id"] | "", scratch["name"] | "", scratch["token_text"] | "",
+                   int(scratch["points"] | 10), c);
+    }
+    scratch.clear();
+  } else {
+    char* f[CSV_FIELDS_MAX];
+    int n = splitCsv(rec, len, f, CSV_FIELDS_MAX);
+    if (first) {
+      // A first record naming token_text is a header: map columns by name
+      bool header = false;
+      for (int i = 0; i < n; i++) if (!strcasecmp(f[i], "token_text")) header = true;
+      if (header) {
+        for (int k = 0; k < COL_COUNT; k++) {
+          im.col[k] = -1;
+          for (int i = 0; i < n; i++) if (!strcasecmp(f[i], CSV_COLUMNS[k])) im.col[k] = i;
+        }
+        return;
+      }
+    }
+    auto field = [&](CsvColumn k) -> const char* {
+      int i = im.col[k];
+      return (i >= 0 && i < n) ? f[i] : "";
+    };
+    const char* pts = field(COL_POINTS);
+    ok = im.make(field(COL_ID), field(COL_NAME), field(COL_TOKEN), *pts ? atoi(pts) : 10, c);
+  }
+  if (ok && !saneCheckpointId(c.id)) ok = false;   // whatever `make` let through
+  if (ok && im.next.size() >= MAX_CHECKPOINTS) ok = false;
+  if (ok) ok = checkpointUnique(im.next, c);
+  if (!ok) { rejectImportLine(im); return; }
+  im.next.push_back(c);
+}
+
+static const uint8_t UTF8_BOM[3] = { 0xEF, 0xBB, 0xBF };
+
+void importFeed(CheckpointImport& im, const uint8_t* data, size_t len, JsonDocument& scratch) {
+  for (size_t i = 0; i < len; i++) {
+    char ch = (char)data[i];
+    if (im.bom >= 0) {
+      // Drop a BOM before the format sniff sees it, even split across chunks
+      if (data[i] == UTF8_BOM[im.bom]) { if (++im.bom == 3) im.bom = -1; continue; }
+      int matched = im.bom;
+      im.bom = -1;
+      importFeed(im, UTF8_BOM, matched, scratch);   // not a BOM after all: keep its bytes
+    }
+    if (im.sniff && !isspace((unsigned char)ch)) {
+      im.fmt = (ch == '{') ? BULK_NDJSON : BULK_CSV;
+      im.sniff = false;
+    }
+    if (ch == '\n') { importLine(im, scratch); continue; }
+    if (ch == '\r') continue;
+    if (im.lineLen < IMPORT_LINE_MAX) im.line[im.lineLen++] = ch;
+    else im.overflow = true;
+  }
+}
+
+void importFinish(CheckpointImport& im, JsonDocument& scratch) {
+  if (im.lineLen || im.overflow) importLine(im, scratch);
+}
+
+bool importInstallable(const CheckpointImport& im, bool partial, bool replace) {
+  if (im.next.empty()) return replace;
+  return im.rejected == 0 || partial || replace;
+}
+
+// ------------------ Binary snapshots ------------------
+// Little-endian layout:
+//   header  u32 magic "SCVB", u16 version, u16 kind, u32 payload length, u32 CRC-32 of payload,
+//           u32 sequence, u32 ~sequence (version 1 files stop after the CRC and read as sequence 0)
+//   strings u16 length + bytes
+//   SNAP_CHECKPOINTS: u32 n, n x { id, name, token_text, i32 points }
+//   SNAP_TEAMS:       u32 m, m x checkpoint id (the list found[] indexes into),
+//                     u32 n, n x { id, name, pin_hash, u32 created_at, u16 k, k x u16 index }
+// Points are not stored; they are recomputed from found[] on load.
+
+#define SNAP_MAGIC      0x42564353u   // "SCVB"
+#define SNAP_VERSION    2
+#define SNAP_HEADER_LEN SNAPSHOT_HEADER_MAX
+#define SNAP_V1_HEADER_LEN 16
+
+enum : uint16_t { SNAP_CHECKPOINTS = 1, SNAP_TEAMS = 2 };
+
+struct SnapWriter {
+  std::vector<uint8_t> buf;
+  SnapWriter() : buf(SNAP_HEADER_LEN, 0) {}
+  void u16(uint16_t v) { buf.push_back(v & 0xFF); buf.push_back(v >> 8); }
+  void u32(uint32_t v) { u16(v & 0xFFFF); u16(v >> 16); }
+  void str(const String& s) {
+    uint16_t n = s.length() > 0xFFFF ? 0xFFFF : s.length();
+    u16(n);
+    buf.insert(buf.end(), (const uint8_t*)s.c_str(), (const uint8_t*)s.c_str() + n);
+  }
+  void put16(size_t at, uint16_t v) { buf[at] = v & 0xFF; buf[at + 1] = v >> 8; }
+  void put32(size_t at, uint32_t v) { put16(at, v & 0xFFFF); put16(at + 2, v >> 16); }
+  void finish(uint16_t kind, uint32_t seq) {
+    uint32_t len = buf.size() - SNAP_HEADER_LEN;
+    put32(0, SNAP_MAGIC);
+    put16(4, SNAP_VERSION);
+    put16(6, kind);
+    put32(8, len);
+    put32(12, snapshotCrc32(buf.data() + SNAP_HEADER_LEN, len));
+    put32(16, seq);
+    put32(20, ~seq);
+  }
+};
+
+// Reads from a buffer with one spare byte past the end (openSnapshot adds it),
+// so strings can be NUL-terminated in place. Any overrun clears ok.
+struct SnapReader {
+  uint8_t* p = nullptr;
+  size_t n = 0, pos = 0;
+  bool ok = true;
+  bool need(size_t k) { if (ok && n - pos < k) ok = false; return ok; }
+  uint16_t u16() { if (!need(2)) return 0; uint16_t v = p[pos] | (p[pos + 1] << 8); pos += 2; return v; }
+  uint32_t u32() { uint32_t lo = u16(); return lo | ((uint32_t)u16() << 16); }
+  String str() {
+    uint16_t len = u16();
+    if (!need(len)) return String();
+    uint8_t saved = p[pos + len];
+    p[pos + len] = 0;
+    String s((const char*)p + pos);
+    p[pos + len] = saved;
+    pos += len;
+    return s;
+  }
+};
+
+bool snapshotInfo(const uint8_t* p, size_t n, SnapshotInfo& out) {
+  if (n < SNAP_V1_HEADER_LEN) return false;
+  SnapReader r;
+  r.p = const_cast<uint8_t*>(p); r.n = n;
+  if (r.u32() != SNAP_MAGIC) return false;
+  out.version = r.u16();
+  out.kind = r.u16();
+  out.len = r.u32();
+  out.crc = r.u32();
+  out.seq = 0;
+  if (out.version == 1) { out.header_len = SNAP_V1_HEADER_LEN; return true; }
+  if (out.version != SNAP_VERSION || n < SNAP_HEADER_LEN) return false;
+  out.header_len = SNAP_HEADER_LEN;
+  uint32_t seq = r.u32(), check = r.u32();
+  if (seq == ~check) out.seq = seq;   // a damaged sequence just ranks the copy last
+  return true;
+}
+
+static bool openSnapshot(std::vector<uint8_t>& buf, uint16_t kind, SnapReader& r) {
+  SnapshotInfo info;
+  if (!snapshotInfo(buf.data(), buf.size(), info)) return false;
+  buf.push_back(0);  // spare byte for SnapReader::str()
+  r.p = buf.data(); r.n = buf.size() - 1; r.pos = info.header_len; r.ok = true;
+  return info.kind == kind && info.len == r.n - info.header_len &&
+         info.crc == snapshotCrc32(r.p + info.header_len, info.len);
+}
+
+void encodeCheckpointsSnapshot(std::vector<uint8_t>& out, uint32_t seq) {
+  SnapWriter w;
+  w.u32(g_checkpoints.size());
+  for (auto &c : g_checkpoints) {
+    w.str(c.id);
+    w.str(c.name);
+    w.str(c.token_text);
+    w.u32((uint32_t)c.points);
+  }
+  w.finish(SNAP_CHECKPOINTS, seq);
+  out.swap(w.buf);
+}
+
+bool decodeCheckpointsSnapshot(std::vector<uint8_t>& buf) {
+  SnapReader r;
+  if (!openSnapshot(buf, SNAP_CHECKPOINTS, r)) return false;
+  uint32_t n = r.u32();
+  if (n > MAX_CHECKPOINTS) return false;
+  std::vector<Checkpoint> list;
+  list.reserve(n);
+  for (uint32_t i = 0; i < n && r.ok; i++) {
+    Checkpoint c;
+    c.id         = r.str();
+    c.name       = r.str();
+    c.token_text = r.str();
+    c.points     = (int32_t)r.u32();
+    c.slot       = (uint16_t)i;
+    list.push_back(c);
+  }
+  if (!r.ok) return false;
+  g_checkpoints.swap(list);
+  return true;
+}
+
+void encodeTeamsSnapshot(std::vector<uint8_t>& out, uint32_t seq) {
+  SnapWriter w;
+  w.u32(g_checkpoints.size());
+  for (auto &c : g_checkpoints) w.str(c.id);
+  w.u32(g_teams.size());
+  for (auto &t : g_teams) {
+    w.str(t.id);
+    w.str(t.name);
+    w.str(t.pin_hash);
+    w.u32(t.created_at);
+    size_t at = w.buf.size();
+    uint16_t k = 0;
+    w.u16(0);
+    for (size_t i = 0; i < g_checkpoints.size(); i++) {
+      if (t.found.has(g_checkpoints[i].slot)) { w.u16((uint16_t)i); k++; }
+    }
+    w.put16(at, k);
+  }
+  w.finish(SNAP_TEAMS, seq);
+  out.swap(w.buf);
+}
+
+bool decodeTeamsSnapshot(std::vector<uint8_t>& buf) {
+  SnapReader r;
+  if (!openSnapshot(buf, SNAP_TEAMS, r)) return false;
+  uint32_t m = r.u32();
+  if (m > MAX_CHECKPOINTS) return false;
+  std::vector<uint16_t> slotOf(m, NO_SLOT);  // snapshot index -> current slot
+  for (uint32_t i = 0; i < m && r.ok; i++) {
+    Checkpoint* c = findCheckpointById(r.str());
+    if (c) slotOf[i] = c->slot;               // ids of removed checkpoints are dropped
+  }
+  uint32_t n = r.u32();
+  if (!r.ok || n > r.n / 12) return false;    // 12 = smallest possible team record
+  std::vector<Team> list;
+  list.reserve(n);
+  for (uint32_t i = 0; i < n && r.ok; i++) {
+    Team t;
+    t.id         = r.str();
+    t.name       = r.str();
+    t.pin_hash   = r.str();
+    t.created_at = r.u32();
+    uint16_t k = r.u16();
+    for (uint16_t j = 0; j < k && r.ok; j++) {
+      uint16_t ix = r.u16();
+      if (ix < m && slotOf[ix] != NO_SLOT) t.found.set(slotOf[ix]);
+    }
+    list.push_back(t);
+  }
+  if (!r.ok) return false;
+  g_teams.swap(list);
+  rebuildTeamIndex();
+  return true;
+}
@@ -0,0 +1,178 @@
+#pragma once
+// Game engine: checkpoints, teams, codeword lookup, scoring, ranking and the
+// binary snapshot encoding. No Wi-Fi, HTTP or filesystem in here, so it
+// builds for the board and for the host (env:native) alike; src/main.cpp is
+// the glue around it. Callers own locking (see StateLock in main.cpp).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <ArduinoJson.h>
+#include "engine_string.h"
+
+// Functional limits
+#define TOKEN_MAXLEN     64
+#define NAME_MAXLEN      40
+#define ID_MAXLEN        32
+#define LEADERBOARD_SIZE 20
+#define MAX_CHECKPOINTS 512  // bitset slots per team (multiple of 32)
+#define RECENT_FINDS       4  // finds per team remembered in order, for item deltas
+
+// Types
+#define NO_SLOT 0xFFFF
+
+struct Checkpoint {
+  String id;
+  String name;
+  String token_text; // exact codeword
+  String token_key;  // case-folded token_text, maintained by rebuildTokenIndex()
+  int points = 10;
+  uint16_t slot = NO_SLOT; // stable bit position in FoundSet while the checkpoint exists
+};
+
+// Per-team progress: one bit per checkpoint slot
+struct FoundSet {
+  uint32_t w[MAX_CHECKPOINTS / 32] = {0};
+  bool has(uint16_t slot) const { return slot < MAX_CHECKPOINTS && (w[slot >> 5] >> (slot & 31)) & 1u; }
+  void set(uint16_t slot)       { if (slot < MAX_CHECKPOINTS) w[slot >> 5] |= 1u << (slot & 31); }
+  void clear(uint16_t slot)     { if (slot < MAX_CHECKPOINTS) w[slot >> 5] &= ~(1u << (slot & 31)); }
+  int count() const {
+    int n = 0;
+    for (uint32_t x : w) n += __builtin_popcount(x);
+    return n;
+  }
+};
+
+struct Team {
+  String id;
+  String name;
+  String pin_hash;
+  FoundSet found;    // checkpoint slots; ids only at the persistence boundary
+  int points = 0;
+  uint32_t created_at = 0;
+  // recent[n % RECENT_FINDS] is the slot of the team's n-th find (0-based).
+  // Only finds made since boot/load are here: recent_from is the find count
+  // when the ring started, NO_SLOT until the first find.
+  uint16_t recent[RECENT_FINDS] = {0};
+  uint16_t recent_from = NO_SLOT;
+};
+
+extern std::vector<Checkpoint> g_checkpoints;
+extern std::vector<Team> g_teams;
+
+// Helpers
+bool consttime_eq(const String& a, const String& b);
+bool consttime_eq(const char* a, size_t la, const char* b, size_t lb);
+uint32_t fnv1a(const char* s, size_t n);
+uint32_t snapshotCrc32(const uint8_t* p, size_t n);
+
+// Checkpoints: slot table + token index, rebuilt whenever g_checkpoints changes.
+// g_checkpointsDigest hashes the player-visible list (id, name, points, in
+// order) and is its version/ETag; being content-derived, and independent of
+// the slots assigned at load, it stays valid across reboots.
+extern uint32_t g_checkpointsDigest;
+void reindexCheckpoints();
+void rebuildTokenIndex();
+Checkpoint* findCheckpointBySlot(uint16_t slot);
+Checkpoint* findCheckpointByToken(const String& token);
+Checkpoint* findCheckpointByToken(const char* token, size_t len);
+Checkpoint* findCheckpointById(const String& id);
+// Install `next` as g_checkpoints (it gets the old table back). Existing ids
+// keep their slot, so teams' found bits stay put; slots that disappear are
+// cleared from every team. Rescores and re-ranks all teams.
+void replaceCheckpoints(std::vector<Checkpoint>& next);
+// True if c's id and codeword (case-folded, like lookups) are new to `table`,
+// which is being built for replaceCheckpoints(); fills c.token_key. A repeated
+// codeword would otherwise be dropped silently by rebuildTokenIndex().
+bool checkpointUnique(const std::vector<Checkpoint>& table, Checkpoint& c);
+// Checkpoint ids end up in URLs and in the tab-separated team journal:
+// 1..ID_MAXLEN of [A-Za-z0-9_.-], the same set team ids use.
+bool saneCheckpointId(const String& id);
+
+// Teams: id and name hash indexes over g_teams (same numbering as the ranking).
+// Call teamIndexAdd() after push_back and rebuildTeamIndex() after removing,
+// reordering or replacing teams.
+void rebuildTeamIndex();
+void teamIndexAdd(size_t idx);
+Team* findTeamById(const String& id);
+Team* findTeamById(const char* id);
+Team* findTeamByName(const String& nm);
+
+// Scoring
+void updatePointsFromFound(Team& t);
+bool teamFoundHas(const Team& t, const Checkpoint& c);
+bool teamAddFound(Team& t, const Checkpoint& c);
+// Slots the team found after its first `since` finds, oldest first, into
+// out[RECENT_FINDS]. Returns how many, or -1 if the ring doesn't cover them.
+int teamFindsSince(const Team& t, int since, uint16_t* out);
+
+// Ranking. g_leaderboardVersion changes whenever the visible top list may have.
+extern uint32_t g_leaderboardVersion;
+void rebuildRanking();
+void rankTeamAdded(size_t idx);
+void rankTeamScored(size_t idx);
+void leaderboardToJson(JsonArray arr);
+
+// Ordered views over g_teams indices for paging. teamRanking() is the live
+// best-first order; teamsByName() is case-insensitive name order, kept up to
+// date lazily. g_teamsLayoutVersion bumps whenever rebuildTeamIndex() runs, i.e.
+// whenever an index may now point at a different team.
+extern uint32_t g_teamsLayoutVersion;
+const std::vector<uint16_t>& teamRanking();
+const std::vector<uint16_t>& teamsByName();
+
+// Bulk checkpoint import: CSV or NDJSON records parsed line by line as upload
+// chunks arrive, so a whole hunt needs one line buffer plus the new table.
+// `make` is the caller's validation of one record. Bad lines, repeated ids and
+// repeated codewords (compared case-folded, like lookups) are counted and
+// skipped; nothing is installed here, see importInstallable(). A leading UTF-8
+// BOM and blank lines before the first record (as spreadsheets export) are
+// ignored.
+#define IMPORT_LINE_MAX 320   // longest accepted record
+#define CSV_FIELDS_MAX    8
+
+enum BulkFormat : uint8_t { BULK_NDJSON, BULK_CSV };
+enum CsvColumn : uint8_t { COL_ID, COL_NAME, COL_TOKEN, COL_POINTS, COL_COUNT };
+extern const char* const CSV_COLUMNS[COL_COUNT];   // "id", "name", "token_text", "points"
+
+typedef bool (*ImportMakeFn)(const char* id, const char* name, const char* token, int points,
+                             Checkpoint& c);
+
+struct CheckpointImport {
+  ImportMakeFn make = nullptr;
+  BulkFormat fmt = BULK_NDJSON;
+  bool sniff = true;              // format not given: decide from the first byte
+  std::vector<Checkpoint> next;
+  char line[IMPORT_LINE_MAX + 1];
+  size_t lineLen = 0;
+  bool overflow = false;          // current line is longer than IMPORT_LINE_MAX
+  uint32_t lineNo = 0;
+  int8_t bom = 0;                 // UTF-8 BOM bytes matched at the start, -1 once past it
+  bool seenRecord = false;        // a non-blank line has arrived (CSV header candidate)
+  uint32_t rejected = 0, firstRejected = 0;
+  int8_t col[COL_COUNT] = { 0, 1, 2, 3 };   // CSV field index per column, -1 = absent
+};
+
+// `scratch` parses NDJSON records; it is cleared for every line.
+void importFeed(CheckpointImport& im, const uint8_t* data, size_t len, JsonDocument& scratch);
+void importFinish(CheckpointImport& im, JsonDocument& scratch);   // last line without '\n'
+// An import replaces the whole table, so an empty one needs `replace` and one
+// with rejected lines needs `partial` (or `replace`) before it may go in.
+bool importInstallable(const CheckpointImport& im, bool partial, bool replace);
+
+// Binary snapshots. Decoders take the raw file bytes (they may append to the
+// buffer) and replace g_checkpoints / g_teams only if the whole file is valid.
+// `seq` is stamped into the header so the newer of two copies can be told apart.
+#define SNAPSHOT_HEADER_MAX 24
+struct SnapshotInfo {
+  uint16_t version, kind;
+  uint32_t len, crc;        // payload length and CRC-32 (identical content => identical pair)
+  uint32_t seq;             // 0 for version 1 or a damaged sequence field
+  size_t header_len;
+};
+// Parse just the header (first SNAPSHOT_HEADER_MAX bytes are enough); the payload isn't checked.
+bool snapshotInfo(const uint8_t* p, size_t n, SnapshotInfo& out);
+void encodeCheckpointsSnapshot(std::vector<uint8_t>& out, uint32_t seq = 0);
+bool decodeCheckpointsSnapshot(std::vector<uint8_t>& buf);
+void encodeTeamsSnapshot(std::vector<uint8_t>& out, uint32_t seq = 0);
+bool decodeTeamsSnapshot(std::vector<uint8_t>& buf);   // needs g_checkpoints indexed
@@ -0,0 +1,33 @@
+#pragma once
+// On the device the engine uses Arduino's String. Host builds (env:native)
+// get this small stand-in with just the members the engine touches.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  bool isEmpty() const { return s_.empty(); }
+  void reserve(unsigned int n) { s_.reserve(n); }
+  String& operator=(const char* s) { s_ = s ? s : ""; return *this; }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* s) { s_ += s; return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* s) const { return s_ == (s ? s : ""); }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  bool operator!=(const char* s) const { return !(*this == s); }
+  char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+ private:
+  std::string s_;
+};
+#endif
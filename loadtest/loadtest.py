@@ -0,0 +1,406 @@
+"""
+Event-day load generator for a live kiosk.
+
+Simulates N phones against a real device on its AP: each one runs a captive
+probe sequence, registers (or logs in) a team, polls /api/leaderboard every
+6 s like the player page does without a live stream, and submits codewords at
+a configurable rate. With the admin password it also scrapes
+/api/admin/metrics over the run and reports heap drift and fragmentation.
+
+Only the Python 3 standard library is needed:
+
+    python loadtest/loadtest.py --host 192.168.4.1 --phones 40 --duration 600 \\
+        --admin-pass hunter22 --submit-rate 2
+
+The device rate-limits per source IP (see RATE_LIMITS in src/main.cpp), so
+phones sharing one address will see 429s, mostly while registering. To model
+separate phones, give the host several addresses on the AP subnet and pass
+them with --source-ip (phones are spread across them round-robin).
+
+Exit status is 1 when a --max-* gate is exceeded, so a run can be used as a
+regression check.
+"""
+import argparse
+import http.client
+import json
+import math
+import random
+import sys
+import threading
+import time
+
+PROBES = [
+    "/generate_204",          # Android
+    "/hotspot-detect.html",   # Apple
+    "/connecttest.txt",       # Windows
+    "/success.txt",           # Firefox
+]
+
+LEADERBOARD_POLL_S = 6.0      # player page poll interval while SSE is down
+
+
+# ------------------ HTTP ------------------
+
+class Device:
+    def __init__(self, host, port, timeout):
+        self.host = host
+        self.port = port
+        self.timeout = timeout
+
+    def request(self, method, path, body=None, headers=None, source=None):
+        """Returns (status, parsed JSON or raw bytes, headers, seconds); status 0 on transport error."""
+        hdrs = dict(headers or {})
+        data = None
+        if body is not None:
+            data = json.dumps(body).encode()
+            hdrs["Content-Type"] = "application/json"
+        t0 = time.monotonic()
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout,
+                                          source_address=(source, 0) if source else None)
+        try:
+            conn.request(method, path, body=data, headers=hdrs)
+            resp = conn.getresponse()
+            raw = resp.read()
+            dt = time.monotonic() - t0
+            payload = raw
+            if resp.getheader("Content-Type", "").startswith("application/json"):
+                try:
+                    payload = json.loads(raw)
+                except ValueError:
+                    pass
+            return resp.status, payload, resp, dt
+        except (OSError, http.client.HTTPException):
+            return 0, None, None, time.monotonic() - t0
+        finally:
+            conn.close()
+
+
+# ------------------ Stats ------------------
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.samples = {}     # op -> [latency seconds]
+        self.counts = {}      # op -> {"ok", "limited", "error"}
+
+    def record(self, op, ok, status, dt):
+        with self.lock:
+            c = self.counts.setdefault(op, {"ok": 0, "limited": 0, "error": 0})
+            if status == 429:
+                c["limited"] += 1
+            elif ok:
+                c["ok"] += 1
+                self.samples.setdefault(op, []).append(dt)
+            else:
+                c["error"] += 1
+
+    def summary(self):
+        out = {}
+        with self.lock:
+            for op, c in sorted(self.counts.items()):
+                lat = sorted(self.samples.get(op, []))
+                total = c["ok"] + c["limited"] + c["error"]
+                out[op] = dict(c, total=total,
+                               error_rate=c["error"] / total if total else 0.0,
+                               p50_ms=pct(lat, 50), p90_ms=pct(lat, 90),
+                               p99_ms=pct(lat, 99), max_ms=lat[-1] * 1000 if lat else None)
+        return out
+
+
+def pct(sorted_lat, p):
+    if not sorted_lat:
+        return None
+    k = max(0, min(len(sorted_lat), math.ceil(p / 100.0 * len(sorted_lat))) - 1)   # nearest rank
+    return sorted_lat[k] * 1000
+
+
+# ------------------ Phones ------------------
+
+class Phone(threading.Thread):
+    def __init__(self, n, args, dev, stats, tokens, stop, source):
+        super().__init__(daemon=True)
+        self.n = n
+        self.args = args
+        self.dev = dev
+        self.stats = stats
+        self.tokens = tokens
+        self.stop = stop
+        self.source = source
+        self.session = None
+        self.rng = random.Random(args.seed * 1000 + n)
+
+    def call(self, op, method, path, body=None, expect=(200,), auth=True):
+        hdrs = {"Authorization": "Bearer " + self.session} if auth and self.session else None
+        status, payload, resp, dt = self.dev.request(method, path, body, hdrs, self.source)
+        self.stats.record(op, status in expect, status, dt)
+        if status == 429 and resp is not None:
+            # honour Retry-After like a polite phone would, capped so the run keeps moving
+            wait = float(resp.getheader("Retry-After", "1") or 1)
+            self.stop.wait(min(wait, 30.0))
+        return status, payload
+
+    def onboard(self):
+        probe = self.rng.choice(PROBES)
+        self.call("probe", "GET", probe, expect=(200, 204, 302), auth=False)
+        self.call("app", "GET", "/app", expect=(200,), auth=False)
+        self.call("items", "GET", "/api/items", expect=(200, 304), auth=False)
+        self.call("probe", "GET", probe, expect=(200, 204), auth=False)
+
+    def sign_in(self):
+        body = {"team_name": "%s-%03d" % (self.args.team_prefix, self.n), "pin": "%06d" % (100000 + self.n)}
+        while not self.stop.is_set():
+            status, r = self.call("register", "POST", "/api/register", body, expect=(200, 409), auth=False)
+            if status == 409:
+                status, r = self.call("login", "POST", "/api/login", body, expect=(200,), auth=False)
+            if status == 200 and isinstance(r, dict) and r.get("token"):
+                self.session = r["token"]
+                return True
+            if status != 429:
+                self.stop.wait(2.0)
+        return False
+
+    def submit(self):
+        if self.tokens and self.rng.random() >= self.args.miss_ratio:
+            code, expect = self.rng.choice(self.tokens), (200,)
+        else:
+            code, expect = "nope-%06d" % self.rng.randrange(10 ** 6), (404,)
+        status, _ = self.call("submit", "POST", "/api/team/submit_code", {"token": code}, expect=expect)
+        if status == 401:
+            self.session = None
+
+    def run(self):
+        self.stop.wait(self.rng.uniform(0, self.args.ramp))
+        if self.stop.is_set():
+            return
+        self.onboard()
+        if not self.sign_in():
+            return
+        self.call("team_items", "POST", "/api/team/items", {"since": ""})
+        next_poll = time.monotonic()
+        rate = self.args.submit_rate / 60.0
+        next_submit = time.monotonic() + (self.rng.expovariate(rate) if rate > 0 else float("inf"))
+        while not self.stop.is_set():
+            now = time.monotonic()
+            if now >= next_poll:
+                self.call("leaderboard", "GET", "/api/leaderboard", auth=False)
+                next_poll = now + LEADERBOARD_POLL_S
+            if now >= next_submit:
+                if self.session is None and not self.sign_in():
+                    return
+                self.submit()
+                next_submit = now + self.rng.expovariate(rate)
+            self.stop.wait(max(0.05, min(next_poll, next_submit) - time.monotonic()))
+
+
+# ------------------ Admin side ------------------
+
+def admin_login(dev, password):
+    status, r, _, _ = dev.request("POST", "/api/admin/login", {"pass": password})
+    if status != 200 or not isinstance(r, dict):
+        sys.exit("admin login failed (HTTP %d)" % status)
+    return {"Authorization": "Bearer " + r["token"]}
+
+
+def fetch_tokens(dev, auth):
+    status, r, _, _ = dev.request("GET", "/api/admin/checkpoints", headers=auth)
+    if status != 200 or not isinstance(r, dict):
+        return []
+    return [c["token_text"] for c in r.get("items", []) if c.get("token_text")]
+
+
+class MetricsScraper(threading.Thread):
+    def __init__(self, dev, auth, interval, stop, csv_path):
+        super().__init__(daemon=True)
+        self.dev = dev
+        self.auth = auth
+        self.interval = interval
+        self.stop = stop
+        self.csv_path = csv_path
+        self.samples = []     # (t, free, min_free, largest_block, stations, rate_limited)
+        self.failures = 0
+
+    def run(self):
+        t0 = time.monotonic()
+        while True:
+            status, r, _, _ = self.dev.request("GET", "/api/admin/metrics", headers=self.auth)
+            if status == 200 and isinstance(r, dict):
+                h, net = r.get("heap", {}), r.get("net", {})
+                self.samples.append((time.monotonic() - t0, h.get("free", 0), h.get("min_free", 0),
+                                     h.get("largest_block", 0), net.get("stations", 0),
+                                     net.get("rate_limited", 0)))
+            else:
+                self.failures += 1
+            if self.stop.wait(self.interval):
+                break
+        if self.csv_path:
+            with open(self.csv_path, "w") as f:
+                f.write("t_s,free,min_free,largest_block,stations,rate_limited\n")
+                for s in self.samples:
+                    f.write("%.1f,%d,%d,%d,%d,%d\n" % s)
+
+    def summary(self):
+        if not self.samples:
+            return None
+        first, last = self.samples[0], self.samples[-1]
+        frag = lambda s: 1.0 - (s[3] / s[1]) if s[1] else 0.0
+        return {
+            "samples": len(self.samples),
+            "scrape_failures": self.failures,
+            "free_first": first[1], "free_last": last[1],
+            "free_drift": last[1] - first[1],
+            "free_slope_per_hour": slope([(s[0], s[1]) for s in self.samples]) * 3600,
+            "min_free": min(s[2] for s in self.samples),
+            "largest_block_first": first[3], "largest_block_last": last[3],
+            "fragmentation_first": frag(first), "fragmentation_last": frag(last),
+            "fragmentation_max": max(frag(s) for s in self.samples),
+            "stations_peak": max(s[4] for s in self.samples),
+            "rate_limited_device": last[5] - first[5],
+        }
+
+
+def slope(points):
+    """Least-squares slope of (x, y) points; 0 with fewer than two."""
+    n = len(points)
+    if n < 2:
+        return 0.0
+    mx = sum(p[0] for p in points) / n
+    my = sum(p[1] for p in points) / n
+    den = sum((p[0] - mx) ** 2 for p in points)
+    return sum((p[0] - mx) * (p[1] - my) for p in points) / den if den else 0.0
+
+
+def cleanup(dev, auth, prefix):
+    page = "/api/admin/teams?limit=200&fields=id&prefix=" + prefix + "-"
+    removed = 0
+    while True:
+        status, r, _, _ = dev.request("GET", page, headers=auth)
+        if status != 200 or not isinstance(r, dict) or not r.get("teams"):
+            return removed
+        batch = 0
+        for t in r["teams"]:
+            s, _, _, _ = dev.request("DELETE", "/api/admin/teams/" + t["id"], headers=auth)
+            batch += s == 200
+        if batch == 0:
+            return removed
+        removed += batch
+
+
+# ------------------ Report ------------------
+
+def fmt_ms(v):
+    return "%7.1f" % v if v is not None else "      -"
+
+
+def print_report(ops, heap, elapsed):
+    print("\n%d s run" % elapsed)
+    print("%-12s %7s %7s %7s %7s %7s %7s %7s %7s" %
+          ("op", "total", "ok", "429", "errors", "p50ms", "p90ms", "p99ms", "maxms"))
+    for op, c in ops.items():
+        print("%-12s %7d %7d %7d %7d %s %s %s %s" %
+              (op, c["total"], c["ok"], c["limited"], c["error"],
+               fmt_ms(c["p50_ms"]), fmt_ms(c["p90_ms"]), fmt_ms(c["p99_ms"]), fmt_ms(c["max_ms"])))
+    if heap:
+        print("\nheap free %d -> %d (drift %+d, %+.0f B/h), min_free %d" %
+              (heap["free_first"], heap["free_last"], heap["free_drift"],
+               heap["free_slope_per_hour"], heap["min_free"]))
+        print("largest block %d -> %d, fragmentation %.1f%% -> %.1f%% (max %.1f%%)" %
+              (heap["largest_block_first"], heap["largest_block_last"],
+               100 * heap["fragmentation_first"], 100 * heap["fragmentation_last"],
+               100 * heap["fragmentation_max"]))
+        print("stations peak %d, device 429s %d, %d samples (%d failed scrapes)" %
+              (heap["stations_peak"], heap["rate_limited_device"], heap["samples"], heap["scrape_failures"]))
+
+
+def gate(args, ops, heap):
+    failed = []
+    for op, c in ops.items():
+        if args.max_error_rate is not None and c["error_rate"] > args.max_error_rate:
+            failed.append("%s error rate %.2f%% > %.2f%%" % (op, 100 * c["error_rate"], 100 * args.max_error_rate))
+        if args.max_p99_ms is not None and c["p99_ms"] is not None and c["p99_ms"] > args.max_p99_ms:
+            failed.append("%s p99 %.1f ms > %.1f ms" % (op, c["p99_ms"], args.max_p99_ms))
+    if heap and args.max_heap_drift is not None and -heap["free_drift"] > args.max_heap_drift:
+        failed.append("heap dropped %d B > %d B" % (-heap["free_drift"], args.max_heap_drift))
+    if heap and args.max_fragmentation is not None and heap["fragmentation_last"] > args.max_fragmentation:
+        failed.append("fragmentation %.1f%% > %.1f%%" % (100 * heap["fragmentation_last"],
+                                                         100 * args.max_fragmentation))
+    return failed
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0],
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--host", default="192.168.4.1")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--phones", type=int, default=20, help="simulated phones (one team each)")
+    ap.add_argument("--duration", type=float, default=300, help="seconds of load after start")
+    ap.add_argument("--ramp", type=float, default=30, help="spread phone start-up over this many seconds")
+    ap.add_argument("--submit-rate", type=float, default=1.0, help="codeword submits per phone per minute")
+    ap.add_argument("--miss-ratio", type=float, default=0.3, help="share of submits with a wrong code")
+    ap.add_argument("--team-prefix", default="load", help="teams are named <prefix>-NNN")
+    ap.add_argument("--source-ip", action="append", default=[], help="local address to bind (repeatable)")
+    ap.add_argument("--admin-pass", help="enables real codewords, metrics scraping and --cleanup")
+    ap.add_argument("--metrics-interval", type=float, default=10)
+    ap.add_argument("--metrics-csv", help="write the metrics samples here")
+    ap.add_argument("--cleanup", action="store_true", help="delete the load teams afterwards")
+    ap.add_argument("--timeout", type=float, default=10)
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--json", help="write the summary as JSON here")
+    ap.add_argument("--max-error-rate", type=float, help="gate: per-op error share (0..1)")
+    ap.add_argument("--max-p99-ms", type=float, help="gate: per-op p99 latency")
+    ap.add_argument("--max-heap-drift", type=int, help="gate: bytes of free heap lost over the run")
+    ap.add_argument("--max-fragmentation", type=float, help="gate: final 1 - largest_block/free (0..1)")
+    args = ap.parse_args()
+
+    dev = Device(args.host, args.port, args.timeout)
+    stop = threading.Event()
+    stats = Stats()
+
+    auth, tokens, scraper = None, [], None
+    if args.admin_pass:
+        auth = admin_login(dev, args.admin_pass)
+        tokens = fetch_tokens(dev, auth)
+        print("%d codewords from the device" % len(tokens))
+        scraper = MetricsScraper(dev, auth, args.metrics_interval, stop, args.metrics_csv)
+        scraper.start()
+    else:
+        print("no --admin-pass: submitting wrong codes only, no metrics")
+
+    sources = args.source_ip or [None]
+    phones = [Phone(i, args, dev, stats, tokens, stop, sources[i % len(sources)]) for i in range(args.phones)]
+    t0 = time.monotonic()
+    for p in phones:
+        p.start()
+    try:
+        while time.monotonic() - t0 < args.duration:
+            time.sleep(min(10.0, args.duration - (time.monotonic() - t0)))
+            ops = stats.summary()
+            done = sum(c["total"] for c in ops.values())
+            print("[%4.0fs] %d requests, %d errors, %d rate-limited" %
+                  (time.monotonic() - t0, done, sum(c["error"] for c in ops.values()),
+                   sum(c["limited"] for c in ops.values())), flush=True)
+    except KeyboardInterrupt:
+        print("interrupted")
+    stop.set()
+    for p in phones:
+        p.join(args.timeout + 1)
+    if scraper:
+        scraper.join(args.timeout + 1)
+    elapsed = time.monotonic() - t0
+
+    ops = stats.summary()
+    heap = scraper.summary() if scraper else None
+    print_report(ops, heap, elapsed)
+    if args.cleanup and auth:
+        print("removed %d load teams" % cleanup(dev, auth, args.team_prefix))
+
+    failed = gate(args, ops, heap)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"elapsed_s": elapsed, "ops": ops, "heap": heap, "gate_failures": failed}, f, indent=2)
+    for msg in failed:
+        print("GATE: " + msg)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
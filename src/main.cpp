@@ -5,7 +5,9 @@
  * - Auto-reset-on-flash: clears admin hash when FW_VERSION changes
  * - Factory reset endpoint to wipe FS and reboot
  * - Player portal uses ONLY a text input for codewords (no camera/QR)
- * - Admin is gated with HTTP Basic Auth after first-time setup
+ * - Admin is gated after first-time setup by session tokens from
+ *   /api/admin/login (Bearer header or cookie); HTTP Basic Auth is still
+ *   accepted for older clients, with verified credentials cached
  *
  * PlatformIO: Arduino framework 2.0.x, LittleFS, AsyncWebServer, ArduinoJson
  */
@@ -20,9 +22,16 @@
 #include <ArduinoJson.h>
 #include <mbedtls/md.h>
 #include <mbedtls/base64.h>
-#include <DNSServer.h>
+#include <mbedtls/pkcs5.h>
+#include <esp_rom_crc.h>
+#include <AsyncUDP.h>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <algorithm>
+#include <new>
+#include "engine.h"       // lib/engine: game state, lookup, scoring, snapshots
+#include "web_assets.h"   // generated from web/ by tools/embed_web.py
 
 // ------------------ FIRMWARE VERSION & RESET POLICY ------------------
 #define FW_VERSION  (__DATE__ " " __TIME__)
@@ -39,47 +48,43 @@
 #define DEFAULT_GAME_SSID  "SCAVENGER"
 #define DEFAULT_GAME_PASS  ""         // OPEN network in game mode
 
-// Functional limits
-#define TOKEN_MAXLEN     64
-#define NAME_MAXLEN      40
+// Functional limits (token/name/checkpoint limits live in engine.h)
 #define PIN_MINLEN        4
 #define PIN_MAXLEN        6
-#define LEADERBOARD_SIZE 20
+
+// Team journal: folded into a fresh teams snapshot once it reaches half the
+// snapshot's size, so folding costs about as much flash as the appends it
+// retires; the bounds keep tiny events from folding constantly and cap the
+// replay a boot has to do.
+#define JOURNAL_MIN_BYTES  2048
+#define JOURNAL_MAX_BYTES 32768
+
+// Largest POST body we will reassemble from multiple TCP segments
+#define MAX_BODY_LEN 32768
 
 // Files
 static const char* FILE_CONFIG       = "/config.json";
-static const char* FILE_CHECKPOINTS  = "/checkpoints.json";
-static const char* FILE_TEAMS        = "/teams.json";
+static const char* FILE_CHECKPOINTS_A = "/checkpoints.a.bin";   // A/B copies (see Snapshot slots)
+static const char* FILE_CHECKPOINTS_B = "/checkpoints.b.bin";
+static const char* FILE_TEAMS_A      = "/teams.a.bin";
+static const char* FILE_TEAMS_B      = "/teams.b.bin";
+static const char* FILE_TEAMS_LOG    = "/teams.log";   // append-only journal on top of the teams snapshot
+// Single-copy binary snapshots from before A/B, read at boot until the first save
+static const char* FILE_CHECKPOINTS  = "/checkpoints.bin";
+static const char* FILE_TEAMS        = "/teams.bin";
+// Pre-binary snapshots, read once at boot to migrate (see Binary snapshots)
+static const char* FILE_CHECKPOINTS_JSON = "/checkpoints.json";
+static const char* FILE_TEAMS_JSON       = "/teams.json";
 
 // ---------------------------------------------------------
 
-// Types
-struct Checkpoint {
-  String id;
-  String name;
-  String token_text; // exact codeword
-  int points = 10;
-};
-
-struct Team {
-  String id;
-  String name;
-  String pin_hash;
-  std::vector<String> found; // checkpoint ids
-  int points = 0;
-  uint32_t created_at = 0;
-};
-
 enum Mode { MODE_SETUP, MODE_GAME };
 
 // Runtime state
 AsyncWebServer server(80);
-DNSServer dnsServer;           // Captive portal DNS
+AsyncUDP dnsUdp;               // Captive portal DNS (see startCaptivePortalDNSOnly)
 Mode mode = MODE_SETUP;
 
-std::vector<Checkpoint> g_checkpoints;
-std::vector<Team> g_teams;
-
 // Forward decls
 void startSetupAP();
 void startGameAP();
@@ -92,28 +97,27 @@ bool saveCheckpoints();
 bool loadCheckpoints();
 bool saveTeams();
 bool loadTeams();
+bool journalTeamRegistered(const Team& t);
+bool journalTeamFound(const Team& t, const String& chkId);
+bool journalTeamDeleted(const String& id);
+void markDirty(uint32_t bits);
+void flushPersistence();
+void startPersistence();
 bool saveConfig();
 bool loadConfig(Mode &outMode, String &adminHash, String &storedVersion);
-bool consttime_eq(const String& a, const String& b);
 String sha256Hex(const String& in);
 String newId(const char* prefix);
+void seedIdSequence();
 void enterSetupMode();
 void enterGameMode();
 void switchAPNow(Mode m);
+void requestAPSwitch(Mode m);
 void setupRoutes();
-void updatePointsFromFound(Team& t);
-Team* findTeamById(const String& id);
-Team* findTeamByName(const String& nm);
-Checkpoint* findCheckpointByToken(const String& token);
-Checkpoint* findCheckpointById(const String& id);
-bool teamFoundHas(const Team& t, const String& chkId);
-bool teamAddFound(Team& t, const String& chkId, int points);
-String htmlIndex();
-String htmlAdmin();
-String pwaManifest();
-String pwaServiceWorker();
-String htmlCaptive();
+typedef std::shared_ptr<const String> LeaderboardSnap;
+LeaderboardSnap leaderboardSnapshot();
+void startEngine();
 void addCaptiveRoute();
+void forgetClients();
 void applyVersionResetIfNeeded(const String& storedVersion);
 void factoryReset(bool wipeAll);
 bool saneToken(const String& s);
@@ -123,6 +127,20 @@ String sanitizeName(const String& s);
 bool wipeAllTeams();
 bool deleteTeamById(const String& id);
 
+// Game-AP radio profile, persisted in /config.json as "game_ap"
+#define AP_BEACON_MIN_TU   100
+#define AP_BEACON_MAX_TU  1000
+#define AP_INACTIVE_MIN_S   10    // IDF floor for softAP station inactivity
+#define AP_INACTIVE_MAX_S 3600
+
+struct ApProfile {
+  uint8_t  max_stations = ESP_WIFI_MAX_CONN_NUM;  // IDF ceiling; more need a second AP
+  uint8_t  channel = 0;          // 0 => least busy of 1/6/11 from the boot scan
+  bool     ht20 = true;          // 802.11b/g/n at 20 MHz; false => b/g only
+  uint16_t beacon_tu = 100;      // beacon interval in TU (1.024 ms)
+  uint16_t inactive_s = 60;      // drop stations silent this long (frees a slot)
+};
+
 // Config
 struct Config {
   String admin_hash;  // sha256
@@ -131,6 +149,7 @@ struct Config {
   String game_ssid  = DEFAULT_GAME_SSID;
   String game_pass  = DEFAULT_GAME_PASS;   // "" => OPEN
   String fw_version = "";                  // persisted firmware version
+  ApProfile game_ap;
   Mode mode = MODE_SETUP;
 } g_config;
 
@@ -140,36 +159,246 @@ static inline String JV_toString(JsonVariant v, const char* def = "") {
   return String(s ? s : def);
 }
 
+// ------------------ JSON document pool ------------------
+// Small request-path JsonDocuments draw their memory from a few fixed arenas
+// in .bss instead of the heap, so hours of small alloc/free cycles can't
+// fragment it. An arena is a bump allocator leased for one document and reset
+// when that document goes away; if every arena is busy, or a document
+// outgrows its arena, it spills to the heap and is counted.
+//
+// The pool is sized for the documents that are made all the time: async_tcp
+// holds at most two at once (a request body and its reply or error), and the
+// engine task one (the leaderboard), so three arenas cover it in 15 KB.
+// DOC_LARGE documents (admin checkpoint tables, backup export/import,
+// metrics) are rare and, for a real hunt, bigger than any arena worth
+// reserving, so they use the heap like boot-time loads and the persistence
+// task do.
+
+#define ARENA_SIZE  5120    // ArduinoJson's first slot pool is 4 KB
+#define ARENA_COUNT 3
+
+enum DocClass : uint8_t { DOC_SMALL, DOC_LARGE };
+
+struct ArenaStats {
+  uint32_t leases;     // documents served from an arena
+  uint32_t exhausted;  // no free arena: whole document on the heap
+  uint32_t spills;     // allocations that overflowed their arena
+};
+static ArenaStats g_arenaStats = {};
+
+struct HeapAllocator : ArduinoJson::Allocator {
+  void* allocate(size_t n) override { return malloc(n); }
+  void deallocate(void* p) override { free(p); }
+  void* reallocate(void* p, size_t n) override { return realloc(p, n); }
+};
+static HeapAllocator g_heapAllocator;
+
+// Blocks are [u32 size, pad][data], 8-byte aligned. Only the newest block can
+// be freed or grown in place, which is exactly ArduinoJson's pattern (grow the
+// string being parsed, shrink pools when done); anything else waits for reset.
+class RequestArena : public ArduinoJson::Allocator {
+ public:
+  void init(uint8_t* mem, size_t cap) { mem_ = mem; cap_ = cap; reset(); }
+  void reset() { used_ = 0; last_ = nullptr; }
+
+  void* allocate(size_t n) override {
+    size_t need = HDR + round8(n);
+    if (cap_ - used_ < need) { g_arenaStats.spills++; return malloc(n); }
+    uint8_t* p = mem_ + used_ + HDR;
+    setSize(p, n);
+    used_ += need;
+    last_ = p;
+    return p;
+  }
+
+  void deallocate(void* p) override {
+    if (!owns(p)) { free(p); return; }
+    if (p == last_) { used_ = (uint8_t*)p - HDR - mem_; last_ = nullptr; }
+  }
+
+  void* reallocate(void* p, size_t n) override {
+    if (!p) return allocate(n);
+    if (!owns(p)) return realloc(p, n);
+    size_t old = sizeOf(p);
+    if (p == last_) {
+      size_t start = (uint8_t*)p - mem_;
+      if (start + round8(n) <= cap_) { setSize(p, n); used_ = start + round8(n); return p; }
+    } else if (n <= old) {
+      return p;
+    }
+    void* q = allocate(n);
+    if (q) { memcpy(q, p, old < n ? old : n); deallocate(p); }
+    return q;
+  }
+
+ private:
+  static const size_t HDR = 8;
+  static size_t round8(size_t n) { return (n + 7) & ~(size_t)7; }
+  static size_t sizeOf(void* p) { return *(uint32_t*)((uint8_t*)p - HDR); }
+  static void setSize(void* p, size_t n) { *(uint32_t*)((uint8_t*)p - HDR) = (uint32_t)n; }
+  bool owns(void* p) const { return p >= mem_ && p < mem_ + cap_; }
+
+  uint8_t* mem_ = nullptr;
+  size_t cap_ = 0, used_ = 0;
+  uint8_t* last_ = nullptr;
+};
+
+alignas(8) static uint8_t g_arenaMem[ARENA_COUNT][ARENA_SIZE];
+static RequestArena g_arenas[ARENA_COUNT];
+static bool g_arenaBusy[ARENA_COUNT];
+static portMUX_TYPE g_arenaMux = portMUX_INITIALIZER_UNLOCKED;  // async_tcp and the engine task both lease
+
+static RequestArena* acquireArena(DocClass cls) {
+  static bool ready = false;
+  if (cls == DOC_LARGE) return nullptr;
+  RequestArena* got = nullptr;
+  portENTER_CRITICAL(&g_arenaMux);
+  if (!ready) {
+    for (int i = 0; i < ARENA_COUNT; i++) g_arenas[i].init(g_arenaMem[i], ARENA_SIZE);
+    ready = true;
+  }
+  for (int i = 0; i < ARENA_COUNT && !got; i++) {
+    if (!g_arenaBusy[i]) { g_arenaBusy[i] = true; got = &g_arenas[i]; }
+  }
+  if (got) g_arenaStats.leases++; else g_arenaStats.exhausted++;
+  portEXIT_CRITICAL(&g_arenaMux);
+  return got;
+}
+
+static void releaseArena(RequestArena* a) {
+  if (!a) return;
+  portENTER_CRITICAL(&g_arenaMux);
+  a->reset();
+  g_arenaBusy[a - g_arenas] = false;
+  portEXIT_CRITICAL(&g_arenaMux);
+}
+
+struct ArenaLease {
+  RequestArena* arena;
+  explicit ArenaLease(DocClass cls) : arena(acquireArena(cls)) {}
+  ~ArenaLease() { releaseArena(arena); }
+  ArenaLease(const ArenaLease&) = delete;
+  ArenaLease& operator=(const ArenaLease&) = delete;
+  ArduinoJson::Allocator* allocator() { return arena ? (ArduinoJson::Allocator*)arena : &g_heapAllocator; }
+};
+
+// Drop-in JsonDocument for handlers. The lease base is built first and torn
+// down last, so the document never outlives its arena.
+class RequestDoc : private ArenaLease, public JsonDocument {
+ public:
+  explicit RequestDoc(DocClass cls) : ArenaLease(cls), JsonDocument(allocator()) {}
+};
+
 // ------------------ FS helpers ------------------
 
+// Everything on flash is moved in FS_BLOCK_SIZE pieces. Per-byte reads used to
+// cost a VFS call (plus an available() size/position query) each; a block is
+// small enough for any task stack and large enough that call overhead vanishes.
+#define FS_BLOCK_SIZE 1024
+
+static bool readBlocks(File& f, uint8_t* dst, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    size_t want = len - done;
+    if (want > FS_BLOCK_SIZE) want = FS_BLOCK_SIZE;
+    size_t n = f.read(dst + done, want);
+    if (n == 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+static bool writeBlocks(File& f, const uint8_t* src, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    size_t want = len - done;
+    if (want > FS_BLOCK_SIZE) want = FS_BLOCK_SIZE;
+    size_t n = f.write(src + done, want);
+    if (n != want) return false;
+    done += n;
+  }
+  return true;
+}
+
 bool readFileToString(const char* path, String &out) {
   File f = LittleFS.open(path, "r");
   if (!f) return false;
-  out.reserve(f.size()+8);
+  size_t left = f.size();
   out = "";
-  while (f.available()) out += char(f.read());
+  out.reserve(left);
+  char block[FS_BLOCK_SIZE + 1];
+  while (left > 0) {
+    size_t n = f.read((uint8_t*)block, left < FS_BLOCK_SIZE ? left : FS_BLOCK_SIZE);
+    if (n == 0) break;
+    block[n] = 0;   // text files only: no embedded NULs
+    out += block;
+    left -= n;
+  }
   f.close();
-  return true;
+  return left == 0;
 }
 
-bool writeStringToFile(const char* path, const String &data) {
+bool readFileBytes(const char* path, std::vector<uint8_t> &out) {
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  out.resize(f.size());
+  bool ok = readBlocks(f, out.data(), out.size());
+  f.close();
+  return ok;
+}
+
+// Write path.tmp, then rename it over path. LittleFS renames onto an existing
+// file atomically, so path is always either the old or the new content.
+bool writeBytesToFile(const char* path, const uint8_t* data, size_t len) {
   String tmp = String(path) + ".tmp";
   File t = LittleFS.open(tmp.c_str(), "w");
   if (!t) return false;
-  size_t n = t.print(data);
+  bool ok = writeBlocks(t, data, len);
   t.close();
-  if (n != data.length()) { LittleFS.remove(tmp.c_str()); return false; }
-  LittleFS.remove(path);
+  if (!ok) { LittleFS.remove(tmp.c_str()); return false; }
   return LittleFS.rename(tmp.c_str(), path);
 }
 
+// Older builds removed path before renaming path.tmp into place; a power cut
+// in between left only the (complete) temp file. Finish that rename.
+static void recoverTmpFile(const char* path) {
+  String tmp = String(path) + ".tmp";
+  if (!LittleFS.exists(path) && LittleFS.exists(tmp.c_str())) {
+    Serial.printf("[FS] %s: recovering from %s\n", path, tmp.c_str());
+    LittleFS.rename(tmp.c_str(), path);
+  }
+}
+
+bool writeStringToFile(const char* path, const String &data) {
+  return writeBytesToFile(path, (const uint8_t*)data.c_str(), data.length());
+}
+
 void removeIfExists(const char* path){
   if (LittleFS.exists(path)) LittleFS.remove(path);
 }
 
 // Load/save config
-bool saveConfig() {
-  DynamicJsonDocument doc(1024);
+static void apProfileToJson(JsonObject o, const ApProfile& p) {
+  o["max_stations"] = p.max_stations;
+  o["channel"]      = p.channel;
+  o["ht20"]         = p.ht20;
+  o["beacon_tu"]    = p.beacon_tu;
+  o["inactive_s"]   = p.inactive_s;
+}
+
+static int clampInt(int v, int lo, int hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+// Missing fields keep their current value; out-of-range ones are clamped
+static void apProfileFromJson(JsonObject o, ApProfile& p) {
+  p.max_stations = clampInt(o["max_stations"] | (int)p.max_stations, 1, ESP_WIFI_MAX_CONN_NUM);
+  p.channel      = clampInt(o["channel"]      | (int)p.channel, 0, 13);
+  p.ht20         = o["ht20"] | p.ht20;
+  p.beacon_tu    = clampInt(o["beacon_tu"]    | (int)p.beacon_tu, AP_BEACON_MIN_TU, AP_BEACON_MAX_TU);
+  p.inactive_s   = clampInt(o["inactive_s"]   | (int)p.inactive_s, AP_INACTIVE_MIN_S, AP_INACTIVE_MAX_S);
+}
+
+static void serializeConfig(String& out) {
+  JsonDocument doc;
   doc["admin_hash"] = g_config.admin_hash;
   doc["setup_ssid"] = g_config.setup_ssid;
   doc["setup_pass"] = g_config.setup_pass;
@@ -177,15 +406,23 @@ bool saveConfig() {
   doc["game_pass"]  = ""; // force OPEN for game mode on save
   doc["mode"]       = (g_config.mode == MODE_SETUP) ? "setup" : "game";
   doc["fw_version"] = g_config.fw_version;
-  String out;
+  apProfileToJson(doc["game_ap"].to<JsonObject>(), g_config.game_ap);
   serializeJson(doc, out);
+}
+
+// Direct write, for boot before startPersistence() only; after that config
+// changes go through markDirty(DIRTY_CONFIG) so the persistence task stays
+// the only writer.
+bool saveConfig() {
+  String out; serializeConfig(out);
   return writeStringToFile(FILE_CONFIG, out);
 }
 
 bool loadConfig(Mode &outMode, String &adminHash, String &storedVersion) {
   String s;
+  recoverTmpFile(FILE_CONFIG);
   if (!readFileToString(FILE_CONFIG, s)) return false;
-  DynamicJsonDocument doc(2048);
+  JsonDocument doc;
   auto err = deserializeJson(doc, s);
   if (err) return false;
 
@@ -196,6 +433,8 @@ bool loadConfig(Mode &outMode, String &adminHash, String &storedVersion) {
   // Force open AP by ignoring stored game_pass
   g_config.game_pass  = "";
   g_config.fw_version = JV_toString(doc["fw_version"], "");
+  g_config.game_ap = ApProfile();
+  if (doc["game_ap"].is<JsonObject>()) apProfileFromJson(doc["game_ap"].as<JsonObject>(), g_config.game_ap);
   String m = JV_toString(doc["mode"], "setup");
   outMode = (m == "game") ? MODE_GAME : MODE_SETUP;
 
@@ -204,76 +443,477 @@ bool loadConfig(Mode &outMode, String &adminHash, String &storedVersion) {
   return true;
 }
 
+// ------------------ Binary snapshots ------------------
+// Checkpoints and teams each live in a length-prefixed, CRC-checked binary
+// file (layout in lib/engine/src/engine.cpp) that is read with a single bulk
+// read and decoded straight into g_checkpoints / g_teams, with no JSON DOM
+// and no fixed document capacity in the way. A file that fails any check is
+// ignored, and the pre-binary JSON file is used if present.
+
+// -------- Snapshot slots --------
+// Each snapshot is kept as two files, A and B, stamped with a sequence number.
+// A save rewrites the older copy in place, so the newest complete copy is never
+// touched while flash is being written: a power cut mid-save leaves a torn file
+// that fails its CRC, and boot takes the other copy (plus the team journal,
+// which is only truncated once a snapshot has landed). Boot reads the
+// headers, then decodes the newest copy and falls back to older ones only if
+// it is damaged: at most two full reads, or three while the single-copy file
+// from older firmware is still there (until the first save after upgrading).
+// Saves whose content matches the newest copy are skipped. Only the persistence task (or boot, before it starts) writes.
+
+struct SnapshotSlots {
+  SnapshotSlots(const char* a, const char* b, const char* old) : path{a, b}, legacy(old) {}
+  const char* path[2];
+  const char* legacy;          // single-copy file from older firmware, read until the first save
+  uint32_t seq = 0;            // highest sequence seen on flash; the next save uses seq + 1
+  int8_t newest = -1;          // slot holding the copy in RAM, -1 if it came from elsewhere
+  uint32_t len = 0, crc = 0;   // that copy's payload, to spot no-op saves
+  bool legacyPresent = false;
+};
+
+static SnapshotSlots g_checkpointSlots(FILE_CHECKPOINTS_A, FILE_CHECKPOINTS_B, FILE_CHECKPOINTS);
+static SnapshotSlots g_teamSlots(FILE_TEAMS_A, FILE_TEAMS_B, FILE_TEAMS);
+
+static bool readSnapshotHeader(const char* path, SnapshotInfo& info) {
+  if (!LittleFS.exists(path)) return false;
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  uint8_t hdr[SNAPSHOT_HEADER_MAX];
+  size_t n = f.read(hdr, sizeof(hdr));
+  f.close();
+  return snapshotInfo(hdr, n, info);
+}
+
+// Decode the newest valid copy among A, B and the legacy file.
+static bool loadSnapshotSlots(SnapshotSlots& s, bool (*decode)(std::vector<uint8_t>&)) {
+  struct Candidate { int slot; uint32_t seq; };   // slot 2 => legacy
+  Candidate c[3];
+  int n = 0;
+  s.seq = 0; s.newest = -1; s.len = s.crc = 0;
+  recoverTmpFile(s.legacy);
+  s.legacyPresent = LittleFS.exists(s.legacy);
+  for (int i = 0; i < 3; i++) {
+    SnapshotInfo info;
+    if (!readSnapshotHeader(i < 2 ? s.path[i] : s.legacy, info)) continue;
+    if (info.seq > s.seq) s.seq = info.seq;
+    c[n++] = { i, info.seq };
+  }
+  std::sort(c, c + n, [](const Candidate& a, const Candidate& b){ return a.seq > b.seq; });
+  for (int k = 0; k < n; k++) {
+    const char* path = c[k].slot < 2 ? s.path[c[k].slot] : s.legacy;
+    std::vector<uint8_t> buf;
+    SnapshotInfo info;
+    if (readFileBytes(path, buf) && snapshotInfo(buf.data(), buf.size(), info) && decode(buf)) {
+      if (k > 0) Serial.printf("[FS] %s: newer copy unusable, loaded seq %u\n", path, (unsigned)info.seq);
+      if (c[k].slot < 2) { s.newest = c[k].slot; s.len = info.len; s.crc = info.crc; }
+      return true;
+    }
+    Serial.printf("[FS] %s: bad snapshot, ignoring\n", path);
+  }
+  return false;
+}
+
+// Write an encoded snapshot (stamped with s.seq + 1) over the older copy.
+// `wrote` is false when the content matched the newest copy and nothing was written.
+static bool writeSnapshotSlot(SnapshotSlots& s, const std::vector<uint8_t>& bytes, bool* wrote = nullptr) {
+  if (wrote) *wrote = false;
+  SnapshotInfo info;
+  if (!snapshotInfo(bytes.data(), bytes.size(), info)) return false;
+  if (s.newest >= 0 && info.len == s.len && info.crc == s.crc) return true;
+  int slot = s.newest == 0 ? 1 : 0;
+  File f = LittleFS.open(s.path[slot], "w");
+  if (!f) return false;
+  bool ok = writeBlocks(f, bytes.data(), bytes.size());
+  f.close();
+  // a failed write is a torn copy with a lower rank than the good one; it gets rewritten next time
+  if (!ok) return false;
+  s.seq = info.seq; s.newest = slot; s.len = info.len; s.crc = info.crc;
+  if (s.legacyPresent) { removeIfExists(s.legacy); s.legacyPresent = false; }
+  if (wrote) *wrote = true;
+  return true;
+}
+
+static void removeSnapshotSlots(SnapshotSlots& s) {
+  removeIfExists(s.path[0]);
+  removeIfExists(s.path[1]);
+  removeIfExists(s.legacy);
+  s.seq = 0; s.newest = -1; s.len = s.crc = 0; s.legacyPresent = false;
+}
+
 // Load/save checkpoints
+static void serializeCheckpoints(std::vector<uint8_t>& out) {
+  encodeCheckpointsSnapshot(out, g_checkpointSlots.seq + 1);
+}
+
 bool saveCheckpoints() {
-  DynamicJsonDocument doc(4096);
-  JsonArray arr = doc.to<JsonArray>();
+  std::vector<uint8_t> out; serializeCheckpoints(out);
+  return writeSnapshotSlot(g_checkpointSlots, out);
+}
+
+static bool loadCheckpointsSnapshot() {
+  return loadSnapshotSlots(g_checkpointSlots, decodeCheckpointsSnapshot);
+}
+
+// JSON form: the pre-binary files, and admin export/import
+static void checkpointsToJson(JsonArray arr) {
   for (auto &c : g_checkpoints) {
-    JsonObject o = arr.createNestedObject();
+    JsonObject o = arr.add<JsonObject>();
     o["id"] = c.id;
     o["name"] = c.name;
     o["token_text"] = c.token_text;
     o["points"] = c.points;
   }
-  String out;
-  serializeJson(doc, out);
-  return writeStringToFile(FILE_CHECKPOINTS, out);
 }
 
-bool loadCheckpoints() {
-  String s; g_checkpoints.clear();
-  if (!readFileToString(FILE_CHECKPOINTS, s)) return false;
-  DynamicJsonDocument doc(8192);
-  if (deserializeJson(doc, s)) return false;
-  for (JsonObject o : doc.as<JsonArray>()) {
+static void checkpointsFromJson(JsonArray arr) {
+  g_checkpoints.clear();
+  for (JsonObject o : arr) {
     Checkpoint c;
     c.id         = JV_toString(o["id"], "");
     c.name       = JV_toString(o["name"], "");
     c.token_text = JV_toString(o["token_text"], "");
     c.points     = int(o["points"] | 10);
+    if (g_checkpoints.size() >= MAX_CHECKPOINTS) break;
+    c.slot       = (uint16_t)g_checkpoints.size();
     g_checkpoints.push_back(c);
   }
-  return true;
+}
+
+bool loadCheckpoints() {
+  g_checkpoints.clear(); reindexCheckpoints();
+  bool ok = loadCheckpointsSnapshot();
+  if (!ok) {
+    String s;
+    if (!readFileToString(FILE_CHECKPOINTS_JSON, s)) return false;
+    JsonDocument doc;
+    if (deserializeJson(doc, s)) return false;
+    checkpointsFromJson(doc.as<JsonArray>());
+    Serial.printf("[FS] Migrating %u checkpoints from JSON\n", (unsigned)g_checkpoints.size());
+    if (saveCheckpoints()) removeIfExists(FILE_CHECKPOINTS_JSON);
+    ok = true;
+  }
+  reindexCheckpoints();
+  return ok;
 }
 
 // Load/save teams
+//
+// g_teamSlots holds a full snapshot; FILE_TEAMS_LOG holds one line per change made
+// since that snapshot, so a submit only appends a few bytes instead of rewriting
+// every team. Fields are tab-separated (sanitizeName strips control chars):
+//   R <id> <created_at> <pin_hash> <name>   team registered
+//   F <team_id> <checkpoint_id> <t>         checkpoint found at t (seconds)
+//   D <team_id>                             team deleted
+// Replay is idempotent, so a crash between snapshot and journal truncation is harmless.
+
+static uint32_t g_journalEvents = 0;   // lines in FILE_TEAMS_LOG
+static uint32_t g_journalBytes = 0;    // and its size
+
+static void serializeTeams(std::vector<uint8_t>& out) {
+  encodeTeamsSnapshot(out, g_teamSlots.seq + 1);
+}
+
+static bool writeTeamsSnapshot(const std::vector<uint8_t>& out, bool* wrote = nullptr) {
+  if (!writeSnapshotSlot(g_teamSlots, out, wrote)) return false;
+  // Snapshot now covers everything journaled so far
+  removeIfExists(FILE_TEAMS_LOG);
+  g_journalEvents = 0;
+  g_journalBytes = 0;
+  return true;
+}
+
+// Journal size at which persistDirty() folds it into a snapshot instead.
+static uint32_t journalFoldBytes() {
+  uint32_t half = g_teamSlots.len / 2;
+  return half < JOURNAL_MIN_BYTES ? JOURNAL_MIN_BYTES : (half > JOURNAL_MAX_BYTES ? JOURNAL_MAX_BYTES : half);
+}
+
 bool saveTeams() {
-  DynamicJsonDocument doc(16384);
-  JsonArray arr = doc.to<JsonArray>();
+  std::vector<uint8_t> out; serializeTeams(out);
+  return writeTeamsSnapshot(out);
+}
+
+static bool loadTeamsSnapshot() {
+  return loadSnapshotSlots(g_teamSlots, decodeTeamsSnapshot);
+}
+
+static void teamsToJson(JsonArray arr) {
   for (auto &t : g_teams) {
-    JsonObject o = arr.createNestedObject();
+    JsonObject o = arr.add<JsonObject>();
     o["id"] = t.id;
     o["name"] = t.name;
     o["pin_hash"] = t.pin_hash;
     o["points"] = t.points;
     o["created_at"] = t.created_at;
-    JsonArray f = o.createNestedArray("found");
-    for (auto &x : t.found) f.add(x);
+    JsonArray f = o["found"].to<JsonArray>();
+    for (auto &c : g_checkpoints) if (t.found.has(c.slot)) f.add(c.id);
   }
-  String out; serializeJson(doc, out);
-  return writeStringToFile(FILE_TEAMS, out);
 }
 
-bool loadTeams() {
-  String s; g_teams.clear();
-  if (!readFileToString(FILE_TEAMS, s)) return false;
-  DynamicJsonDocument doc(32768);
-  if (deserializeJson(doc, s)) return false;
-  for (JsonObject o : doc.as<JsonArray>()) {
+static void teamsFromJson(JsonArray arr) {
+  g_teams.clear();
+  for (JsonObject o : arr) {
     Team t;
     t.id = JV_toString(o["id"], "");
     t.name = JV_toString(o["name"], "");
     t.pin_hash = JV_toString(o["pin_hash"], "");
     t.points = int(o["points"] | 0);
     t.created_at = uint32_t(o["created_at"] | 0);
-    if (o.containsKey("found")) {
-      for (JsonVariant v : o["found"].as<JsonArray>()) t.found.push_back(JV_toString(v, ""));
+    if (o["found"].is<JsonArray>()) {
+      for (JsonVariant v : o["found"].as<JsonArray>()) {
+        Checkpoint* c = findCheckpointById(JV_toString(v, ""));
+        if (c) t.found.set(c->slot);   // ids of removed checkpoints are dropped
+      }
     }
     g_teams.push_back(t);
   }
+  rebuildTeamIndex();
+}
+
+static bool appendJournalLines(const String& lines, uint32_t events) {
+  File f = LittleFS.open(FILE_TEAMS_LOG, "a");
+  if (!f) return false;
+  bool ok = writeBlocks(f, (const uint8_t*)lines.c_str(), lines.length());
+  f.close();
+  if (!ok) return false;
+  g_journalEvents += events;
+  g_journalBytes += lines.length();
+  return true;
+}
+
+static bool journalAppend(const String& line);  // queues for the persistence task
+
+bool journalTeamRegistered(const Team& t) {
+  return journalAppend("R\t" + t.id + "\t" + String(t.created_at) + "\t" + t.pin_hash + "\t" + t.name + "\n");
+}
+
+bool journalTeamFound(const Team& t, const String& chkId) {
+  return journalAppend("F\t" + t.id + "\t" + chkId + "\t" + String((uint32_t)(millis()/1000)) + "\n");
+}
+
+bool journalTeamDeleted(const String& id) {
+  return journalAppend("D\t" + id + "\n");
+}
+
+// Split a journal line on tabs; returns number of fields found (max n).
+static int splitJournalLine(const String& line, String* fields, int n) {
+  int count = 0, start = 0;
+  while (count < n) {
+    int tab = (count == n - 1) ? -1 : line.indexOf('\t', start);
+    if (tab < 0) { fields[count++] = line.substring(start); break; }
+    fields[count++] = line.substring(start, tab);
+    start = tab + 1;
+  }
+  return count;
+}
+
+static void replayJournalLine(const String& line) {
+  String f[5];
+  int n = splitJournalLine(line, f, 5);
+  if (n < 2) return;
+  if (f[0] == "R" && n == 5) {
+    if (findTeamById(f[1])) return;
+    Team t;
+    t.id = f[1];
+    t.created_at = (uint32_t)f[2].toInt();
+    t.pin_hash = f[3];
+    t.name = f[4];
+    g_teams.push_back(t);
+    teamIndexAdd(g_teams.size() - 1);
+  } else if (f[0] == "F" && n >= 3) {
+    Team* t = findTeamById(f[1]);
+    Checkpoint* c = findCheckpointById(f[2]);
+    if (t && c) t->found.set(c->slot);
+  } else if (f[0] == "D") {
+    for (size_t i = 0; i < g_teams.size(); i++) {
+      if (g_teams[i].id == f[1]) { g_teams.erase(g_teams.begin() + i); rebuildTeamIndex(); break; }
+    }
+  }
+}
+
+static bool replayTeamJournal() {
+  String s;
+  g_journalEvents = 0;
+  g_journalBytes = 0;
+  if (!readFileToString(FILE_TEAMS_LOG, s)) return false;
+  g_journalBytes = s.length();
+  int start = 0;
+  while (start < (int)s.length()) {
+    int nl = s.indexOf('\n', start);
+    if (nl < 0) break;  // torn final line from a power cut: drop it
+    replayJournalLine(s.substring(start, nl));
+    g_journalEvents++;
+    start = nl + 1;
+  }
+  return true;
+}
+
+bool loadTeams() {
+  g_teams.clear();
+  bool haveSnapshot = loadTeamsSnapshot();
+  bool migrated = false;
+  if (!haveSnapshot) {
+    String s;
+    JsonDocument doc;
+    if (readFileToString(FILE_TEAMS_JSON, s) && !deserializeJson(doc, s)) {
+      teamsFromJson(doc.as<JsonArray>());
+      Serial.printf("[FS] Migrating %u teams from JSON\n", (unsigned)g_teams.size());
+      haveSnapshot = migrated = true;
+    }
+  }
+  bool haveJournal = replayTeamJournal();
+  if (haveJournal) {
+    for (auto &t : g_teams) updatePointsFromFound(t);
+    Serial.printf("[FS] Replayed %u team journal events\n", (unsigned)g_journalEvents);
+  }
+  // Fold the journal (or the migrated JSON) into a fresh snapshot so the next boot starts clean
+  if (g_journalEvents > 0 || migrated) {
+    if (saveTeams() && migrated) removeIfExists(FILE_TEAMS_JSON);
+  }
+  return haveSnapshot || haveJournal;
+}
+
+// ------------------ Background persistence ------------------
+// Handlers only mark state dirty and return. A task pinned to APP_CPU (Wi-Fi
+// and lwIP live on PRO_CPU) waits PERSIST_COALESCE_MS after the first change,
+// then serializes everything that became dirty in that window under
+// g_stateMutex and does the slow LittleFS writes after releasing it.
+
+#define PERSIST_COALESCE_MS 1500
+#define PERSIST_TASK_STACK  8192
+
+enum : uint32_t { DIRTY_CONFIG = 1, DIRTY_CHECKPOINTS = 2, DIRTY_TEAMS = 4, DIRTY_JOURNAL = 8 };
+
+// Concurrency model: g_teams, g_checkpoints, everything derived from them
+// (slot table, token index, ranking, cached leaderboard) and g_config belong
+// to g_stateMutex. HTTP handlers all run on the single async_tcp task, so they
+// never contend with each other; each takes a StateLock for its whole body and
+// only competes with the persistence task's brief serialization pass.
+// Team*/Checkpoint* from the find* helpers are valid only while the lock is
+// held: anything that outlives the handler (chunked responses) re-locks per
+// chunk and works from indices or copied values. Hashing and flash I/O happen
+// outside the lock.
+static SemaphoreHandle_t g_stateMutex   = nullptr;  // game state + the pending fields below
+static SemaphoreHandle_t g_persistMutex = nullptr;  // one flusher at a time
+static TaskHandle_t g_persistTask = nullptr;
+static uint32_t g_dirty = 0;
+static String g_journalPending;                      // journal lines not yet on flash
+static uint32_t g_journalPendingEvents = 0;
+
+struct StateLock {
+  StateLock()  { if (g_stateMutex) xSemaphoreTakeRecursive(g_stateMutex, portMAX_DELAY); }
+  ~StateLock() { if (g_stateMutex) xSemaphoreGiveRecursive(g_stateMutex); }
+};
+
+void markDirty(uint32_t bits) {
+  { StateLock lock; g_dirty |= bits; }
+  if (g_persistTask) xTaskNotifyGive(g_persistTask);
+}
+
+static bool journalAppend(const String& line) {
+  {
+    StateLock lock;
+    g_journalPending += line;
+    g_journalPendingEvents++;
+  }
+  markDirty(DIRTY_JOURNAL);
   return true;
 }
 
+// Per-file write stats for /api/admin/metrics
+enum FlushKind : uint8_t { FLUSH_CONFIG, FLUSH_CHECKPOINTS, FLUSH_TEAMS, FLUSH_JOURNAL, FLUSH_KINDS };
+static const char* const FLUSH_NAMES[FLUSH_KINDS] = { "config", "checkpoints", "teams", "journal" };
+struct FlushStat { uint32_t count, failures, skipped, total_us, max_us, bytes; };
+static FlushStat g_flushStats[FLUSH_KINDS] = {};
+
+// `bytes` is what reached flash (0 for a failed or skipped write)
+static bool noteFlush(FlushKind k, uint32_t t0, bool ok, size_t bytes) {
+  uint32_t us = micros() - t0;
+  FlushStat &st = g_flushStats[k];
+  st.count++;
+  if (!ok) st.failures++;
+  else st.bytes += bytes;
+  st.total_us += us;
+  if (us > st.max_us) st.max_us = us;
+  return ok;
+}
+
+// Write whatever is dirty right now. Runs on the persistence task, or inline
+// from flushPersistence() when a write must land before we continue.
+static void persistDirty() {
+  if (g_persistMutex) xSemaphoreTake(g_persistMutex, portMAX_DELAY);
+  uint32_t bits, journalEvents;
+  String journal, config;
+  std::vector<uint8_t> teams, checkpoints;
+  {
+    StateLock lock;
+    bits = g_dirty; g_dirty = 0;
+    journal = g_journalPending; g_journalPending = "";
+    journalEvents = g_journalPendingEvents; g_journalPendingEvents = 0;
+    if ((bits & DIRTY_JOURNAL) && g_journalBytes + journal.length() >= journalFoldBytes()) bits |= DIRTY_TEAMS;
+    // A teams snapshot already contains every pending journal line
+    if (bits & DIRTY_TEAMS)       serializeTeams(teams);
+    if (bits & DIRTY_CHECKPOINTS) serializeCheckpoints(checkpoints);
+    if (bits & DIRTY_CONFIG)      serializeConfig(config);
+  }
+  uint32_t failed = 0, t0 = micros();
+  bool wrote;
+  if ((bits & DIRTY_CONFIG) &&
+      !noteFlush(FLUSH_CONFIG, t0, writeStringToFile(FILE_CONFIG, config), config.length()))
+    failed |= DIRTY_CONFIG;
+  t0 = micros();
+  if (bits & DIRTY_CHECKPOINTS) {
+    bool ok = writeSnapshotSlot(g_checkpointSlots, checkpoints, &wrote);
+    if (ok && !wrote) g_flushStats[FLUSH_CHECKPOINTS].skipped++;
+    else if (!noteFlush(FLUSH_CHECKPOINTS, t0, ok, checkpoints.size())) failed |= DIRTY_CHECKPOINTS;
+  }
+  t0 = micros();
+  if (bits & DIRTY_TEAMS) {
+    bool ok = writeTeamsSnapshot(teams, &wrote);
+    if (ok && !wrote) g_flushStats[FLUSH_TEAMS].skipped++;
+    else if (!noteFlush(FLUSH_TEAMS, t0, ok, teams.size())) failed |= DIRTY_TEAMS;
+  } else if (bits & DIRTY_JOURNAL) {
+    if (!noteFlush(FLUSH_JOURNAL, t0, appendJournalLines(journal, journalEvents), journal.length()))
+      failed |= DIRTY_TEAMS;  // retry as a snapshot
+  }
+  if (failed) {
+    Serial.printf("[FS] persist failed (0x%x), retrying\n", (unsigned)failed);
+    { StateLock lock; g_dirty |= failed; }
+  }
+  if (g_persistMutex) xSemaphoreGive(g_persistMutex);
+  if (failed && g_persistTask) xTaskNotifyGive(g_persistTask);
+}
+
+static void persistTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    vTaskDelay(pdMS_TO_TICKS(PERSIST_COALESCE_MS));
+    ulTaskNotifyTake(pdTRUE, 0);  // changes made during the window ride along
+    persistDirty();
+  }
+}
+
+void flushPersistence() { persistDirty(); }
+
+// Drop queued writes (factory reset is about to format the FS).
+static void discardPendingWrites() {
+  if (g_persistMutex) xSemaphoreTake(g_persistMutex, portMAX_DELAY);
+  {
+    StateLock lock;
+    g_dirty = 0;
+    g_journalPending = "";
+    g_journalPendingEvents = 0;
+  }
+  if (g_persistMutex) xSemaphoreGive(g_persistMutex);
+}
+
+void startPersistence() {
+  g_stateMutex   = xSemaphoreCreateRecursiveMutex();
+  g_persistMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(persistTask, "persist", PERSIST_TASK_STACK, nullptr, 1, &g_persistTask, APP_CPU_NUM);
+  if (g_dirty) xTaskNotifyGive(g_persistTask);
+}
+
 void loadAll() {
   String ah; Mode m; String storedVer;
   bool have = loadConfig(m, ah, storedVer);
@@ -289,6 +929,9 @@ void loadAll() {
   // Load data files (may be wiped by version reset)
   loadCheckpoints();
   loadTeams();
+  for (auto &t : g_teams) updatePointsFromFound(t);
+  rebuildRanking();
+  seedIdSequence();
 }
 
 // ------------------ Version reset logic ------------------
@@ -308,11 +951,14 @@ void applyVersionResetIfNeeded(const String& storedVersion) {
     Serial.println("[FW] forced MODE_SETUP");
   }
   if (WIPE_CHECKPOINTS_ON_VERSION) {
-    removeIfExists(FILE_CHECKPOINTS);
+    removeSnapshotSlots(g_checkpointSlots);
+    removeIfExists(FILE_CHECKPOINTS_JSON);
     Serial.println("[FW] wiped checkpoints");
   }
   if (WIPE_TEAMS_ON_VERSION) {
-    removeIfExists(FILE_TEAMS);
+    removeSnapshotSlots(g_teamSlots);
+    removeIfExists(FILE_TEAMS_JSON);
+    removeIfExists(FILE_TEAMS_LOG);
     Serial.println("[FW] wiped teams");
   }
 
@@ -338,62 +984,85 @@ String sha256Hex(const String& in) {
   return h;
 }
 
-bool consttime_eq(const String& a, const String& b) {
-  size_t la = a.length(), lb = b.length();
-  size_t l = (la>lb)?la:lb;
-  byte diff = 0;
-  for (size_t i=0;i<l;i++) {
-    char ca = (i<la)?a[i]:0;
-    char cb = (i<lb)?b[i]:0;
-    diff |= (ca ^ cb);
-  }
-  return diff == 0 && la == lb;
-}
+// Ids are <prefix><sequence>-<suffix>, e.g. "T2s-k7". The base-36 sequence
+// makes them unique; it is seeded past every id loaded from flash (old
+// "T123"-style ids included). The random suffix only keeps them from being
+// guessable in order.
+static uint32_t g_idSeq = 1;
 
-String newId(const char* prefix) {
-  char buf[16];
-  uint32_t r = esp_random();
-  snprintf(buf, sizeof(buf), "%s%03u", prefix, (unsigned)(r % 1000));
-  return String(buf);
-}
+static const char BASE36[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 
-void updatePointsFromFound(Team& t) {
-  int pts = 0;
-  for (auto &cid : t.found) {
-    auto *c = findCheckpointById(cid);
-    if (c) pts += c->points;
+static void noteIdInUse(const String& id) {
+  uint32_t v = 0;
+  for (size_t i = 1; i < id.length() && id[i] != '-'; i++) {
+    const char* d = strchr(BASE36, tolower((unsigned char)id[i]));
+    if (!d || !*d || v > 0x7FFFFFF) return;   // not one of ours
+    v = v * 36 + (uint32_t)(d - BASE36);
   }
-  t.points = pts;
+  if (v >= g_idSeq) g_idSeq = v + 1;
 }
 
-Team* findTeamById(const String& id) {
-  for (auto &t : g_teams) if (t.id == id) return &t;
-  return nullptr;
-}
-Team* findTeamByName(const String& nm) {
-  for (auto &t : g_teams) if (t.name == nm) return &t;
-  return nullptr;
-}
-Checkpoint* findCheckpointByToken(const String& token) {
-  for (auto &c : g_checkpoints) if (consttime_eq(c.token_text, token)) return &c;
-  return nullptr;
-}
-Checkpoint* findCheckpointById(const String& id) {
-  for (auto &c : g_checkpoints) if (c.id == id) return &c;
-  return nullptr;
+void seedIdSequence() {
+  for (auto &c : g_checkpoints) noteIdInUse(c.id);
+  for (auto &t : g_teams) noteIdInUse(t.id);
 }
 
-bool teamFoundHas(const Team& t, const String& chkId) {
-  for (auto &x : t.found) if (x == chkId) return true;
-  return false;
+String newId(const char* prefix) {
+  char seq[8];
+  int n = 0;
+  for (uint32_t v = g_idSeq++; ; v /= 36) {
+    seq[n++] = BASE36[v % 36];
+    if (v < 36) break;
+  }
+  String id(prefix);
+  while (n > 0) id += seq[--n];
+  uint32_t r = esp_random();
+  id += '-';
+  id += BASE36[r % 36];
+  id += BASE36[(r >> 8) % 36];
+  return id;
+}
+
+// ------------------ Leaderboard snapshot ------------------
+// The top LEADERBOARD_SIZE response is serialized by the engine task whenever
+// the engine's g_leaderboardVersion moves, and published as an immutable
+// String. /api/leaderboard and SSE pushes share the current snapshot without
+// taking the state lock; it trails a change by at most ENGINE_TICK_MS.
+
+static LeaderboardSnap g_leaderboardSnap;
+static uint32_t g_leaderboardSnapVersion = 0;     // version g_leaderboardSnap was built from
+static uint32_t g_leaderboardPushedVersion = 0;   // version SSE clients last saw
+static portMUX_TYPE g_snapMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Rebuild the snapshot if the ranking moved; true if a new one was published.
+static bool publishLeaderboard() {
+  LeaderboardSnap next;
+  {
+    StateLock lock;
+    if (g_leaderboardSnap && g_leaderboardSnapVersion == g_leaderboardVersion) return false;
+    RequestDoc d(DOC_SMALL);   // LEADERBOARD_SIZE rows fit one arena
+    leaderboardToJson(d["teams"].to<JsonArray>());
+    auto json = std::make_shared<String>();
+    serializeJson(d, *json);
+    next = json;
+    g_leaderboardSnapVersion = g_leaderboardVersion;
+    portENTER_CRITICAL(&g_snapMux);
+    g_leaderboardSnap.swap(next);
+    portEXIT_CRITICAL(&g_snapMux);
+  }
+  return true;   // `next` (the old snapshot) is released out here, not under the spinlock
 }
 
-bool teamAddFound(Team& t, const String& chkId, int points) {
-  if (teamFoundHas(t, chkId)) return false;
-  t.found.push_back(chkId);
-  updatePointsFromFound(t);
-  (void)points; // points recomputed above
-  return true;
+LeaderboardSnap leaderboardSnapshot() {
+  portENTER_CRITICAL(&g_snapMux);
+  LeaderboardSnap snap = g_leaderboardSnap;
+  portEXIT_CRITICAL(&g_snapMux);
+  if (snap) return snap;
+  publishLeaderboard();   // nothing published yet (engine task not started)
+  portENTER_CRITICAL(&g_snapMux);
+  snap = g_leaderboardSnap;
+  portEXIT_CRITICAL(&g_snapMux);
+  return snap;
 }
 
 // ------------------ Security helpers (GLOBAL SCOPE) ------------------
@@ -426,726 +1095,1966 @@ String sanitizeName(const String& s) {
 
 // ------------------ Wi-Fi/AP + Captive Portal (fixed) ------------------
 
-void startCaptivePortalDNSOnly() {
-  dnsServer.setErrorReplyCode(DNSReplyCode::NoError);
-  dnsServer.start(53, "*", WiFi.softAPIP());
-}
+// Every name resolves to the softAP IP. Queries are answered in the packet
+// handler, which AsyncUDP runs on its own task (lwIP's receive callback only
+// queues the packet for it), so the reply goes out as soon as the packet
+// lands instead of on the next loop() tick. Because that task is neither
+// lwIP's nor async_tcp's, the handler touches only its stack buffer, the
+// preformatted answer (rewritten only while the AP is restarted) and its own
+// counters; it never needs or takes StateLock, and must not block the
+// socket's other traffic. The reply is the question echoed back plus one
+// preformatted A record;
+// AAAA/HTTPS/SVCB and other types get an empty NOERROR so clients fall back
+// to IPv4 at once instead of waiting on a timeout.
+
+#define DNS_PORT     53
+#define DNS_MAX_MSG  512
+#define DNS_TTL_S    60
+
+struct DnsStats {
+  uint32_t queries;    // well-formed questions seen
+  uint32_t answered;   // A/ANY answered with the AP address
+  uint32_t nodata;     // other types answered empty
+  uint32_t dropped;    // malformed or not a standard query
+};
+static DnsStats g_dnsStats = {};
 
-void stopCaptivePortalDNSOnly() { dnsServer.stop(); }
+// Name pointer to the question (0xC00C), type A, class IN, TTL, rdlen 4, address
+static uint8_t g_dnsAnswer[16] = {
+  0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+  (DNS_TTL_S >> 24) & 0xFF, (DNS_TTL_S >> 16) & 0xFF, (DNS_TTL_S >> 8) & 0xFF, DNS_TTL_S & 0xFF,
+  0x00, 0x04, 0, 0, 0, 0
+};
 
-// Register captive handlers ONCE. They choose landing based on current mode at request time.
-void registerCaptiveHandlersOnce(AsyncWebServer& s) {
-  static bool done = false;
-  if (done) return;
-  auto redirectToCurrentLanding = [](AsyncWebServerRequest *r){
-    const char* landing = (g_config.mode == MODE_SETUP) ? "/admin" : "/captive";
-    r->redirect(landing);
-  };
-  s.on("/generate_204",        HTTP_ANY, redirectToCurrentLanding); // Android
-  s.on("/hotspot-detect.html", HTTP_ANY, redirectToCurrentLanding); // iOS/macOS
-  s.on("/ncsi.txt",            HTTP_ANY, redirectToCurrentLanding); // Windows
-  s.on("/connecttest.txt",     HTTP_ANY, redirectToCurrentLanding); // Others
-  s.onNotFound(redirectToCurrentLanding);
-  done = true;
+static void answerDnsQuery(AsyncUDPPacket& pkt) {
+  const uint8_t* q = pkt.data();
+  size_t n = pkt.length();
+  // Header: id, flags, qd/an/ns/ar counts. Only plain single-question queries.
+  if (n < 12 || n > DNS_MAX_MSG || (q[2] & 0x80) || (q[2] & 0x78) || q[4] != 0 || q[5] != 1) {
+    g_dnsStats.dropped++;
+    return;
+  }
+  size_t i = 12;
+  while (i < n && q[i] != 0) {
+    if (q[i] & 0xC0) { g_dnsStats.dropped++; return; }  // no compression in a question
+    i += q[i] + 1;
+  }
+  if (i + 5 > n) { g_dnsStats.dropped++; return; }
+  size_t qend = i + 5;                                  // zero label + qtype + qclass
+  uint16_t qtype  = (q[i + 1] << 8) | q[i + 2];
+  uint16_t qclass = (q[i + 3] << 8) | q[i + 4];
+  g_dnsStats.queries++;
+
+  uint8_t out[DNS_MAX_MSG];
+  memcpy(out, q, qend);
+  out[2] = 0x84 | (q[2] & 0x01);                        // QR, AA, keep RD
+  out[3] = 0x00;                                        // no RA, NOERROR
+  out[6] = out[7] = out[8] = out[9] = out[10] = out[11] = 0;
+  size_t len = qend;
+  if ((qtype == 1 || qtype == 255) && qclass == 1 && len + sizeof(g_dnsAnswer) <= sizeof(out)) {
+    memcpy(out + len, g_dnsAnswer, sizeof(g_dnsAnswer));
+    len += sizeof(g_dnsAnswer);
+    out[7] = 1;
+    g_dnsStats.answered++;
+  } else {
+    g_dnsStats.nodata++;
+  }
+  pkt.write(out, len);
 }
 
-void startSetupAP() {
-  WiFi.mode(WIFI_AP);
-  WiFi.softAP(g_config.setup_ssid.c_str(), g_config.setup_pass.c_str(), 6, false, 8);
-  Serial.printf("[WiFi] Setup AP: %s (pass: %s) IP: %s\n",
-    g_config.setup_ssid.c_str(), g_config.setup_pass.c_str(), WiFi.softAPIP().toString().c_str());
-  startCaptivePortalDNSOnly();
+static bool g_dnsListening = false;
+
+// Idempotent: refreshes the answered address, binds only the first time
+void startCaptivePortalDNSOnly() {
+  uint32_t ip = (uint32_t)WiFi.softAPIP();   // already network byte order in memory
+  memcpy(g_dnsAnswer + 12, &ip, 4);
+  if (g_dnsListening) return;
+  if (dnsUdp.listen(DNS_PORT)) {
+    dnsUdp.onPacket(answerDnsQuery);
+    g_dnsListening = true;
+  } else {
+    Serial.println("[DNS] listen failed");
+  }
 }
+void stopCaptivePortalDNSOnly() { dnsUdp.close(); g_dnsListening = false; }
 
-void startGameAP() {
-  WiFi.mode(WIFI_AP);
-  WiFi.softAP(g_config.game_ssid.c_str(), NULL, 6, false, 12); // OPEN
-  Serial.printf("[WiFi] Game AP: %s (OPEN) IP: %s\n",
-    g_config.game_ssid.c_str(), WiFi.softAPIP().toString().c_str());
-  startCaptivePortalDNSOnly();
+// -------- Channel scan + AP profile --------
+// One scan at boot (STA mode, before any AP is up) scores the non-overlapping
+// channels 1/6/11 by how loud their neighbours are: each network adds its
+// signal above the noise floor, weighted by how far its channel overlaps.
+// Both APs use the quietest one unless the profile pins a channel.
+
+#define SCAN_CANDIDATES 3
+static const uint8_t SCAN_CHANNELS[SCAN_CANDIDATES] = { 1, 6, 11 };
+
+struct ChannelScan {
+  bool done = false;
+  int16_t networks = 0;
+  uint32_t score[SCAN_CANDIDATES] = {0};
+  uint8_t best = 6;
+};
+static ChannelScan g_scan;
+
+static void scanChannelsOnce() {
+  if (g_scan.done) return;
+  g_scan.done = true;
+  WiFi.mode(WIFI_STA);
+  int16_t n = WiFi.scanNetworks(false, true);   // blocking, include hidden
+  if (n < 0) { Serial.println("[WiFi] channel scan failed, using 6"); return; }
+  g_scan.networks = n;
+  for (int16_t i = 0; i < n; i++) {
+    int ch = WiFi.channel(i);
+    int loud = clampInt(WiFi.RSSI(i) + 100, 1, 100);   // dB above ~-100 dBm
+    for (int k = 0; k < SCAN_CANDIDATES; k++) {
+      int d = abs(ch - SCAN_CHANNELS[k]);
+      if (d < 5) g_scan.score[k] += (uint32_t)loud * (5 - d);   // 20 MHz channels overlap up to +-4
+    }
+  }
+  WiFi.scanDelete();
+  int best = 1;  // prefer 6 on ties: it is what the board always used
+  for (int k = 0; k < SCAN_CANDIDATES; k++) if (g_scan.score[k] < g_scan.score[best]) best = k;
+  g_scan.best = SCAN_CHANNELS[best];
+  Serial.printf("[WiFi] %d networks nearby; scores 1:%u 6:%u 11:%u -> channel %u\n", n,
+    (unsigned)g_scan.score[0], (unsigned)g_scan.score[1], (unsigned)g_scan.score[2], g_scan.best);
+}
+
+static uint8_t apChannel(const ApProfile& p) { return p.channel ? p.channel : g_scan.best; }
+
+// Radio settings softAP() doesn't take; applied right after it
+static void applyApRadio(const ApProfile& p) {
+  esp_wifi_set_protocol(WIFI_IF_AP, p.ht20 ? (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N)
+                                           : (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G));
+  if (p.ht20) esp_wifi_set_bandwidth(WIFI_IF_AP, WIFI_BW_HT20);   // 11B/G has no HT bandwidth to set
+  wifi_config_t conf;
+  if (esp_wifi_get_config(WIFI_IF_AP, &conf) == ESP_OK && conf.ap.beacon_interval != p.beacon_tu) {
+    conf.ap.beacon_interval = p.beacon_tu;
+    esp_wifi_set_config(WIFI_IF_AP, &conf);
+  }
+  esp_wifi_set_inactive_time(WIFI_IF_AP, p.inactive_s);
 }
 
-void switchAPNow(Mode m) {
-  WiFi.softAPdisconnect(true);
-  delay(100);
-  stopCaptivePortalDNSOnly();
-  if (m == MODE_SETUP) startSetupAP(); else startGameAP();
+// -------- Station telemetry --------
+// Association events from the Wi-Fi task plus a once-a-minute sample of the
+// station count (last AP_HISTORY_MIN minutes), for sizing max_stations.
+
+#define AP_HISTORY_MIN 60
+
+struct ApStats {
+  uint32_t connects, disconnects;
+  uint8_t peak;                    // most stations at once since the AP came up
+  uint32_t full_s;                 // seconds spent at max_stations
+  uint32_t started_ms;
+  uint8_t history[AP_HISTORY_MIN]; // per-minute station counts, oldest first once full
+  uint8_t historyLen, historyHead;
+};
+static ApStats g_apStats = {};
+static uint8_t g_apMaxStations = 0;   // limits the running AP was started with
+static uint8_t g_apChannel = 0;
+
+static void onApEvent(arduino_event_id_t event, arduino_event_info_t) {
+  if (event == ARDUINO_EVENT_WIFI_AP_STACONNECTED) {
+    g_apStats.connects++;
+    uint8_t n = WiFi.softAPgetStationNum();
+    if (n > g_apStats.peak) g_apStats.peak = n;
+  } else if (event == ARDUINO_EVENT_WIFI_AP_STADISCONNECTED) {
+    g_apStats.disconnects++;
+  }
 }
 
-// ------------------ Web helpers ------------------
+// Called from loop() about once a second
+static void sampleApStations() {
+  static uint32_t lastSecond = 0, lastMinute = 0;
+  uint32_t now = millis();
+  if (now - lastSecond < 1000) return;
+  lastSecond = now;
+  uint8_t n = WiFi.softAPgetStationNum();
+  if (n > g_apStats.peak) g_apStats.peak = n;
+  if (g_apMaxStations && n >= g_apMaxStations) g_apStats.full_s++;
+  if (now - lastMinute < 60000) return;
+  lastMinute = now;
+  g_apStats.history[(g_apStats.historyHead + g_apStats.historyLen) % AP_HISTORY_MIN] = n;
+  if (g_apStats.historyLen < AP_HISTORY_MIN) g_apStats.historyLen++;
+  else g_apStats.historyHead = (g_apStats.historyHead + 1) % AP_HISTORY_MIN;
+}
+
+static void apStatsToJson(JsonObject o) {
+  o["stations"] = WiFi.softAPgetStationNum();
+  o["max_stations"] = g_apMaxStations;
+  o["channel"] = g_apChannel;
+  o["peak"] = g_apStats.peak;
+  o["connects"] = g_apStats.connects;
+  o["disconnects"] = g_apStats.disconnects;
+  o["full_s"] = g_apStats.full_s;
+  o["up_s"] = (uint32_t)((millis() - g_apStats.started_ms) / 1000);
+  JsonArray h = o["per_minute"].to<JsonArray>();
+  for (uint8_t i = 0; i < g_apStats.historyLen; i++) h.add(g_apStats.history[(g_apStats.historyHead + i) % AP_HISTORY_MIN]);
+  JsonObject sc = o["scan"].to<JsonObject>();
+  sc["networks"] = g_scan.networks;
+  for (int k = 0; k < SCAN_CANDIDATES; k++) sc[String(SCAN_CHANNELS[k])] = g_scan.score[k];
+}
+
+static void resetApStats(const ApProfile& p) {
+  g_apStats = ApStats();
+  g_apStats.started_ms = millis();
+  g_apMaxStations = p.max_stations;
+  g_apChannel = apChannel(p);
+}
+
+// SSID, passphrase and radio settings for each mode's AP. The setup AP is
+// always WPA2, which needs an 8-63 character passphrase: softAP() refuses
+// anything else and esp_wifi_set_config would take it. Until an admin
+// password is set, whoever joins the setup AP can claim the admin account,
+// so a bad passphrase (only possible via a hand-edited /config.json) falls
+// back to DEFAULT_SETUP_PASS, never to an open network, and says so in the
+// log and /api/admin/status.
+#define AP_PASS_MIN 8
+#define AP_PASS_MAX 63
+
+struct ApSettings {
+  const String* ssid;
+  const String* pass;   // empty => OPEN (game AP only)
+  bool pass_rejected = false;   // configured passphrase unusable: using DEFAULT_SETUP_PASS
+  ApProfile radio;
+};
 
-void sendJSON(AsyncWebServerRequest *req, int code, JsonDocument &doc) {
-  String out; serializeJson(doc, out);
-  req->send(code, "application/json; charset=utf-8", out);
+static bool apPassUsable(const String& p) {
+  return p.length() >= AP_PASS_MIN && p.length() <= AP_PASS_MAX;
 }
 
-String getBody(AsyncWebServerRequest *request, uint8_t *data, size_t len) {
-  String s; s.reserve(len+1);
-  for (size_t i=0;i<len;i++) s += (char)data[i];
-  return s;
+static ApSettings apSettings(Mode m) {
+  static const String open;
+  static const String fallback = DEFAULT_SETUP_PASS;
+  ApSettings a;
+  if (m == MODE_SETUP) {
+    a.ssid = &g_config.setup_ssid;
+    a.pass = &g_config.setup_pass;
+    if (!apPassUsable(*a.pass)) { a.pass = &fallback; a.pass_rejected = true; }
+    a.radio.max_stations = 8;   // organizers only: defaults, apart from the channel pick
+  } else {
+    a.ssid = &g_config.game_ssid;
+    a.pass = &open;
+    a.radio = g_config.game_ap;
+  }
+  return a;
 }
 
-// -------- Admin auth helpers (HTTP Basic) --------
-static String getHeader(AsyncWebServerRequest *req, const char* name) {
-  if (req->hasHeader(name)) return req->getHeader(name)->value();
-  return String();
+static void logAP(Mode m, const ApSettings& a) {
+  const ApProfile& p = a.radio;
+  if (a.pass_rejected) {
+    Serial.printf("[WiFi] setup_pass must be %d-%d characters; using the built-in default passphrase\n",
+                  AP_PASS_MIN, AP_PASS_MAX);
+  }
+  Serial.printf("[WiFi] %s AP: %s (%s) ch %u, %u stations, %s, beacon %u TU, idle %us IP: %s\n",
+    m == MODE_SETUP ? "Setup" : "Game", a.ssid->c_str(), a.pass->length() ? a.pass->c_str() : "OPEN",
+    apChannel(p), p.max_stations, p.ht20 ? "bgn/HT20" : "bg", p.beacon_tu, p.inactive_s,
+    WiFi.softAPIP().toString().c_str());
 }
 
-static bool parseBasicAuth(const String& auth, String &user, String &pass) {
-  if (!auth.startsWith("Basic ")) return false;
-  String b64 = auth.substring(6);
-  size_t needed = 0;
-  // First call to learn required length
-  mbedtls_base64_decode(nullptr, 0, &needed,
-                        (const unsigned char*)b64.c_str(), b64.length());
-  if (needed == 0) return false;
-  std::vector<unsigned char> buf(needed + 1);
-  size_t olen = 0;
-  if (mbedtls_base64_decode(buf.data(), needed, &olen,
-                            (const unsigned char*)b64.c_str(), b64.length()) != 0) return false;
-  buf[olen] = 0;
-  String decoded = String((const char*)buf.data());
-  int colon = decoded.indexOf(':');
-  if (colon < 0) return false;
-  user = decoded.substring(0, colon);
-  pass = decoded.substring(colon + 1);
+// Full bring-up: boot, or when the AP isn't running
+static void startAP(Mode m) {
+  scanChannelsOnce();
+  ApSettings a = apSettings(m);
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP(a.ssid->c_str(), a.pass->length() ? a.pass->c_str() : NULL, apChannel(a.radio), false,
+              a.radio.max_stations);
+  applyApRadio(a.radio);
+  resetApStats(a.radio);
+  logAP(m, a);
+  startCaptivePortalDNSOnly();
+}
+
+void startSetupAP() { startAP(MODE_SETUP); }
+void startGameAP()  { startAP(MODE_GAME); }
+
+// Swap SSID/auth/radio on the running AP. The netif, DHCP server and AP
+// address stay up, so the DNS responder, HTTP server and leases survive;
+// phones still re-associate because the network they joined is gone.
+// False if the AP isn't up or the driver refused the config.
+static bool reconfigureAPInPlace(Mode m) {
+  if (!(WiFi.getMode() & WIFI_AP)) return false;
+  ApSettings a = apSettings(m);
+  wifi_config_t conf;
+  if (esp_wifi_get_config(WIFI_IF_AP, &conf) != ESP_OK) return false;
+  size_t ssidLen = a.ssid->length() < sizeof(conf.ap.ssid) ? a.ssid->length() : sizeof(conf.ap.ssid);
+  size_t passLen = a.pass->length();   // 0 (game AP) or AP_PASS_MIN..AP_PASS_MAX, see apSettings()
+  memset(conf.ap.ssid, 0, sizeof(conf.ap.ssid));
+  memset(conf.ap.password, 0, sizeof(conf.ap.password));
+  memcpy(conf.ap.ssid, a.ssid->c_str(), ssidLen);
+  memcpy(conf.ap.password, a.pass->c_str(), passLen);
+  conf.ap.ssid_len = ssidLen;
+  conf.ap.authmode = passLen ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+  conf.ap.channel = apChannel(a.radio);
+  conf.ap.max_connection = a.radio.max_stations;
+  conf.ap.beacon_interval = a.radio.beacon_tu;
+  if (esp_wifi_set_config(WIFI_IF_AP, &conf) != ESP_OK) return false;
+  applyApRadio(a.radio);
+  resetApStats(a.radio);
+  logAP(m, a);
+  startCaptivePortalDNSOnly();   // same address; just keeps the answer current
   return true;
 }
 
-static bool adminGuard(AsyncWebServerRequest *req) {
-  // Allow first-time setup without auth
-  if (g_config.admin_hash.length() == 0) return true;
+// -------- Deferred mode switch --------
+// Handlers only record the target mode and answer; a switch torn down from
+// inside the async_tcp callback used to eat its own HTTP response. loop()
+// runs it AP_SWITCH_DELAY_MS later: flush pending writes, warm what game
+// mode reads first, then reconfigure the AP in place (full restart only if
+// the driver refuses). Admins confirm through /api/admin/status.
 
-  // Check Basic auth
-  String u, p;
-  String auth = getHeader(req, "Authorization"); // helper you already defined
-  if (parseBasicAuth(auth, u, p)) {
-    if (consttime_eq(sha256Hex(p), g_config.admin_hash)) return true;
-  }
+#define AP_SWITCH_DELAY_MS 250   // lets the reply leave before the network changes
 
-  // Challenge with WWW-Authenticate on a response object
-  AsyncWebServerResponse* r =
-      req->beginResponse(401, "text/plain", "Authentication required");
-  r->addHeader("WWW-Authenticate", "Basic realm=\"Scavenger Admin\"");
-  req->send(r);
-  return false;
-}
+static const String& landingURL();
 
+// Written by requestAPSwitch() on async_tcp (core 0), consumed by loop() (core 1)
+static std::atomic<int> g_switchTarget(-1);   // Mode to switch to, -1 => none
+static std::atomic<uint32_t> g_switchDueMs(0);
+static TaskHandle_t g_loopTask = nullptr;
+static struct { uint32_t count, last_ms; bool last_in_place; } g_switchStats = {};
 
-// ------------------ HTML & PWA (raw strings) ------------------
-
-// Player portal: codeword-only flow
-static const char HTML_INDEX[] PROGMEM = R"HTML(<!doctype html><html><head>
-<meta charset="utf-8"/>
-<meta name="viewport" content="width=device-width,initial-scale=1"/>
-<link rel="manifest" href="/manifest.webmanifest">
-<title>Scavenger — Player Portal</title>
-<style>
-:root{--b:#222;--t:#fff;--mut:#666}
-body{font-family:system-ui,-apple-system,Segoe UI,Roboto,Ubuntu,Helvetica,Arial,sans-serif;background:#fafafa;margin:16px;color:#111}
-h1{font-size:1.6rem;margin:0 0 12px}
-.card{background:#fff;border:1px solid #ddd;border-radius:12px;padding:12px;margin:10px 0}
-input,button{font-size:1rem;padding:10px;border-radius:10px;border:1px solid #bbb}
-button{background:#222;color:#fff;border:0;cursor:pointer;transition:transform .04s ease,filter .04s ease,box-shadow .08s ease}
-button:active{transform:translateY(1px);filter:brightness(0.92)}
-button.ghost{background:#f3f3f3;color:#111;border:1px solid #ccc}
-button.ghost:active{filter:brightness(0.95);transform:translateY(1px)}
-.row{display:flex;gap:8px;flex-wrap:wrap}
-.badge{background:#eee;border-radius:999px;padding:2px 8px;margin-left:6px}
-.small{color:#555}
-table{width:100%;border-collapse:collapse}
-th,td{border-bottom:1px solid #eee;padding:8px;text-align:left}
-th{background:#f9f9f9}
-.status-found{color:green;font-weight:600}
-.status-miss{color:#b00;font-weight:600}
-.footer{color:#777;font-size:.9rem;margin-top:8px}
-.hint{font-size:.95rem;color:#333}
-.hide{display:none}
-</style>
-</head><body>
-<h1>Scavenger — Player Portal</h1>
-
-<div class="card">
-  <h3>How it works</h3>
-  <p class="small">
-    Connect to the event Wi-Fi, create a team (or log in), and type the <b>codeword</b> printed at each checkpoint.
-  </p>
-</div>
-
-<div class="card" id="auth">
-  <h3>Register / Login</h3>
-  <div class="row">
-    <input id="name" placeholder="Team name" maxlength="40">
-    <input id="pin" placeholder="PIN (4-6)" type="password" maxlength="6">
-    <button onclick="reg()">Register</button>
-    <button class="ghost" onclick="login()">Login</button>
-  </div>
-  <div id="me" class="small"></div>
-</div>
-
-<div class="card">
-  <h3>Leaderboard <span class="badge" id="ts"></span></h3>
-  <div id="lb">Loading…</div>
-</div>
-
-<div class="card hide" id="itemsCard">
-  <h3>Your Items</h3>
-  <table>
-    <thead><tr><th>Item</th><th>Points</th><th>Status</th></tr></thead>
-    <tbody id="itemsBody"></tbody>
-  </table>
-
-  <div style="margin-top:12px">
-    <h3>Enter codeword</h3>
-    <div class="row">
-      <input id="codeword" placeholder="Type codeword here" maxlength="64" style="flex:1;min-width:220px">
-      <button onclick="submitCode()">Submit</button>
-    </div>
-    <div class="hint" style="margin-top:6px">Tip: Codes are not case-sensitive and may include numbers or dashes.</div>
-  </div>
-</div>
-
-<script>
-var team_id=null, team_name="";
-
-function id(x){return document.getElementById(x);}
-function val(x){var el=id(x); return el?el.value:'';}
-
-function j(p,u,f){
-  fetch(u,{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(p)})
-    .then(function(r){return r.json();})
-    .then(f)
-    .catch(function(err){toast((err&&err.message)||'Network error');});
-}
-function t(u,f){
-  fetch(u)
-    .then(function(r){return r.json();})
-    .then(f)
-    .catch(function(err){toast((err&&err.message)||'Network error');});
-}
-
-function reg(){
-  j({team_name:val('name'),pin:val('pin')},'/api/register',function(r){
-    if(r && r.ok){ team_id=r.team_id; team_name=val('name'); onAuth(); }
-    else { toast(JSON.stringify(r)); }
-  });
+void requestAPSwitch(Mode m) {
+  g_switchDueMs = millis() + AP_SWITCH_DELAY_MS;
+  g_switchTarget = (int)m;
+  if (g_loopTask) xTaskNotifyGive(g_loopTask);
 }
-function login(){
-  j({team_name:val('name'),pin:val('pin')},'/api/login',function(r){
-    if(r && r.ok){ team_id=r.team_id; team_name=val('name'); onAuth(); }
-    else { toast(JSON.stringify(r)); }
-  });
+
+void switchAPNow(Mode m) {
+  uint32_t t0 = millis();
+  flushPersistence();
+  {
+    // Build lookups now rather than on the first player request
+    StateLock lock;
+    rebuildTeamIndex();
+  }
+  publishLeaderboard();
+  forgetClients(); // new network: everyone onboards again
+  bool inPlace = reconfigureAPInPlace(m);
+  if (!inPlace) {
+    WiFi.softAPdisconnect(false);
+    startAP(m);
+  }
+  landingURL();   // recache for the new mode/IP
+  g_switchStats.count++;
+  g_switchStats.last_ms = millis() - t0;
+  g_switchStats.last_in_place = inPlace;
+  Serial.printf("[WiFi] switched to %s in %u ms (%s)\n", m == MODE_GAME ? "game" : "setup",
+                (unsigned)g_switchStats.last_ms, inPlace ? "in place" : "restart");
 }
 
-function onAuth(){
-  id('me').textContent='Logged in as: '+team_name;
-  id('itemsCard').classList.remove('hide');
-  loadTeamItems();
+// Called from loop()
+static void runPendingAPSwitch() {
+  int target = g_switchTarget.load();
+  if (target < 0) return;
+  int32_t wait = (int32_t)(g_switchDueMs.load() - millis());
+  if (wait > 0) vTaskDelay(pdMS_TO_TICKS(wait));
+  // A request that came in while waiting is newer: leave it for the next pass
+  if (!g_switchTarget.compare_exchange_strong(target, -1)) return;
+  switchAPNow((Mode)target);
 }
 
-function loadLB(){
-  t('/api/leaderboard',function(r){
-    var h='<ol>';
-    var teams=(r&&r.teams)||[];
-    if(teams.length===0){ h+='<li>No teams yet</li>'; }
-    for(var i=0;i<teams.length;i++){
-      var x=teams[i];
-      h+='<li>'+escapeHtml(x.name)+' — '+(x.points||0)+' pts ('+(x.found||0)+')</li>';
+// ------------------ Web helpers ------------------
+
+void sendJSON(AsyncWebServerRequest *req, int code, JsonDocument &doc) {
+  String out;
+  out.reserve(measureJson(doc));
+  serializeJson(doc, out);
+  req->send(code, "application/json; charset=utf-8", out);
+}
+
+// Pre-serialized error bodies, sent straight from flash without a document
+static const char ERR_ALREADY_CONFIGURED[] = "{\"error\":\"already_configured\"}";
+static const char ERR_AUTH[] = "{\"error\":\"auth\"}";
+static const char ERR_BAD_FIELDS[] = "{\"error\":\"bad_fields\"}";
+static const char ERR_BAD_JSON[] = "{\"error\":\"bad_json\"}";
+static const char ERR_BUSY[] = "{\"error\":\"busy\"}";
+static const char ERR_EMPTY_SSID[] = "{\"error\":\"empty_ssid\"}";
+static const char ERR_EMPTY_TOKEN[] = "{\"error\":\"empty_token\"}";
+static const char ERR_EXISTS[] = "{\"error\":\"exists\"}";
+static const char ERR_HASH_FAILED[] = "{\"error\":\"hash_failed\"}";
+static const char ERR_MISSING_ID[] = "{\"error\":\"missing_id\"}";
+static const char ERR_NEED_CHECKPOINTS_AND_TEAMS[] = "{\"error\":\"need_checkpoints_and_teams\"}";
+static const char ERR_NO_MATCH[] = "{\"error\":\"no_match\"}";
+static const char ERR_NO_MEMORY[] = "{\"error\":\"no_memory\"}";
+static const char ERR_RATE_LIMITED[] = "{\"error\":\"rate_limited\"}";
+static const char ERR_TEAM_NOT_FOUND[] = "{\"error\":\"team_not_found\"}";
+static const char ERR_TOO_LARGE[] = "{\"error\":\"too_large\"}";
+static const char ERR_TOO_MANY_ATTEMPTS[] = "{\"error\":\"too_many_attempts\"}";
+static const char ERR_WEAK_PASS[] = "{\"error\":\"weak_pass\"}";
+
+static AsyncWebServerResponse* errorResponse(AsyncWebServerRequest *req, int code, const char* body) {
+  return req->beginResponse(code, "application/json; charset=utf-8", (const uint8_t*)body, strlen(body));
+}
+
+static void sendError(AsyncWebServerRequest *req, int code, const char* body) {
+  req->send(errorResponse(req, code, body));
+}
+
+// Chunked writer for {"<key>":[...]}: items are serialized one at a time into a
+// small buffer as the TCP window allows, so memory per request stays bounded
+// no matter how many teams/items there are. Indices are re-checked against
+// count() on every chunk, so a list that shrinks mid-stream just ends early.
+#define JSON_ITEM_MAX 320   // Largest single serialized item
+
+typedef std::function<size_t()> JsonCountFn;
+typedef std::function<bool(size_t i, JsonObject o)> JsonItemFn;  // false => skip item i
+
+static volatile uint32_t g_streamsInFlight = 0;   // chunked list responses not yet finished
+
+struct JsonListStream {
+  JsonListStream()  { g_streamsInFlight++; }
+  ~JsonListStream() { g_streamsInFlight--; }
+  JsonCountFn count;
+  JsonItemFn fill;
+  String head;
+  size_t next = 0;
+  uint8_t stage = 0;        // 0 head, 1 items, 2 tail, 3 done
+  bool first = true;
+  char pending[JSON_ITEM_MAX + 2];
+  size_t pendLen = 0, pendOff = 0;
+
+  // Refill pending with the next piece of output; false when finished.
+  bool produce() {
+    pendLen = pendOff = 0;
+    while (pendLen == 0) {
+      if (stage == 0) {
+        // head is just {"key":[ and always fits
+        pendLen = head.length() < sizeof(pending) ? head.length() : sizeof(pending);
+        memcpy(pending, head.c_str(), pendLen);
+        stage = 1;
+      } else if (stage == 1) {
+        if (next >= count()) { stage = 2; continue; }
+        RequestDoc doc(DOC_SMALL);
+        JsonObject o = doc.to<JsonObject>();
+        if (!fill(next++, o)) continue;
+        if (measureJson(o) >= JSON_ITEM_MAX) continue;  // oversized item: drop rather than emit broken JSON
+        size_t off = first ? 0 : 1;
+        if (!first) pending[0] = ',';
+        pendLen = off + serializeJson(o, pending + off, JSON_ITEM_MAX);
+        first = false;
+      } else if (stage == 2) {
+        pending[0] = ']'; pending[1] = '}'; pendLen = 2;
+        stage = 3;
+      } else {
+        return false;
+      }
     }
-    h+='</ol>';
-    id('lb').innerHTML=h;
-    id('ts').textContent=new Date().toLocaleTimeString();
-  });
+    return true;
+  }
+};
+
+// Chunked response pumping a stream's produce()/pending buffer under the state lock.
+template <typename Stream>
+static AsyncWebServerResponse* beginStream(AsyncWebServerRequest *req, const char* type,
+                                           std::shared_ptr<Stream> st) {
+  return req->beginChunkedResponse(type,
+    [st](uint8_t *buf, size_t maxLen, size_t) -> size_t {
+      StateLock lock;
+      size_t out = 0;
+      while (out < maxLen) {
+        if (st->pendOff >= st->pendLen && !st->produce()) break;
+        size_t n = st->pendLen - st->pendOff;
+        if (n > maxLen - out) n = maxLen - out;
+        memcpy(buf + out, st->pending + st->pendOff, n);
+        st->pendOff += n; out += n;
+      }
+      return out;
+    });
+}
+
+// `meta` is raw JSON members (e.g. "\"version\":\"..\"") emitted ahead of the list.
+AsyncWebServerResponse* beginJSONList(AsyncWebServerRequest *req, const char* key, JsonCountFn count,
+                                      JsonItemFn fill, const String& meta = String()) {
+  auto st = std::make_shared<JsonListStream>();
+  st->count = count;
+  st->fill = fill;
+  st->head = "{";
+  if (meta.length()) { st->head += meta; st->head += ","; }
+  st->head += String("\"") + key + "\":[";
+  return beginStream(req, "application/json; charset=utf-8", st);
+}
+
+void sendJSONList(AsyncWebServerRequest *req, const char* key, JsonCountFn count, JsonItemFn fill,
+                  const String& meta = String()) {
+  req->send(beginJSONList(req, key, count, fill, meta));
+}
+
+// Collect a POST body that may arrive split across TCP segments. Returns true
+// once all `total` bytes are available in (body, bodyLen): the caller's buffer
+// itself when the body came in one piece (the common case), otherwise a single
+// buffer pre-sized to `total` and hung off req->_tempObject, which the request
+// frees when it is destroyed.
+static bool collectBody(AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total,
+                        const uint8_t*& body, size_t& bodyLen) {
+  if (index == 0 && len == total) { body = data; bodyLen = len; return true; }
+  if (total > MAX_BODY_LEN) {
+    if (index == 0) sendError(req, 413, ERR_TOO_LARGE);
+    return false;
+  }
+  if (index == 0) {
+    req->_tempObject = malloc(total);
+    if (!req->_tempObject) { sendError(req, 503, ERR_NO_MEMORY); return false; }
+  }
+  if (!req->_tempObject || index + len > total) return false;
+  memcpy((uint8_t*)req->_tempObject + index, data, len);
+  if (index + len < total) return false;
+  body = (const uint8_t*)req->_tempObject; bodyLen = total;
+  return true;
+}
+
+// -------- Per-client admission control --------
+// Small fixed table keyed by the station's IP on the softAP (it never holds
+// more than the AP admits, plus a little churn; the least recently seen entry
+// is recycled). Each entry has one token bucket per endpoint class. Checks run
+// before any body is buffered or parsed, so an over-limit request costs one
+// table scan and a canned 429. Only touched from the async_tcp task.
+
+#define MAX_CLIENTS 32
+
+enum RateClass : uint8_t { RL_AUTH, RL_SUBMIT, RL_READ, RL_CLASSES };
+
+struct RateLimit { float burst; float per_sec; };
+static const RateLimit RATE_LIMITS[RL_CLASSES] = {
+  { 6.0f,  0.2f },   // RL_AUTH:   register/login, 1 per 5 s sustained
+  { 10.0f, 1.0f },   // RL_SUBMIT: codeword submissions
+  { 20.0f, 2.0f },   // RL_READ:   items/leaderboard/team items
+};
+
+struct ClientEntry {
+  uint32_t ip = 0;
+  uint32_t last_seen_ms = 0;
+  float tokens[RL_CLASSES];
+  uint32_t refill_ms[RL_CLASSES];
+  bool onboarded;                // has loaded /app or /admin (see probe responder)
+  uint16_t login_failures;       // admin password failures, see loginThrottled()
+  uint32_t login_blocked_until;  // seconds since boot
+};
+static ClientEntry g_clients[MAX_CLIENTS];
+static uint32_t g_rateLimited = 0;   // requests turned away with 429
+
+static ClientEntry* clientEntry(AsyncWebServerRequest *req) {
+  uint32_t ip = req->client() ? (uint32_t)req->client()->remoteIP() : 0;
+  uint32_t now = millis();
+  int victim = 0;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (g_clients[i].ip == ip && ip != 0) { g_clients[i].last_seen_ms = now; return &g_clients[i]; }
+    if (g_clients[i].ip == 0 ||
+        (g_clients[victim].ip != 0 && g_clients[i].last_seen_ms < g_clients[victim].last_seen_ms)) victim = i;
+  }
+  ClientEntry &e = g_clients[victim];
+  e.ip = ip;
+  e.last_seen_ms = now;
+  e.onboarded = false;
+  e.login_failures = 0;
+  e.login_blocked_until = 0;
+  for (int c = 0; c < RL_CLASSES; c++) { e.tokens[c] = RATE_LIMITS[c].burst; e.refill_ms[c] = now; }
+  return &e;
+}
+
+// Take one token for cls, or answer 429. For body handlers pass the chunk
+// index: only the first chunk is charged, later ones of a refused request
+// are ignored by collectBody() since no buffer was allocated for them.
+static bool admit(AsyncWebServerRequest *req, RateClass cls, size_t index = 0) {
+  if (index != 0) return true;
+  ClientEntry* e = clientEntry(req);
+  uint32_t now = millis();
+  float t = e->tokens[cls] + (now - e->refill_ms[cls]) * RATE_LIMITS[cls].per_sec / 1000.0f;
+  if (t > RATE_LIMITS[cls].burst) t = RATE_LIMITS[cls].burst;
+  e->refill_ms[cls] = now;
+  if (t < 1.0f) {
+    e->tokens[cls] = t;
+    g_rateLimited++;
+    AsyncWebServerResponse* r = errorResponse(req, 429, ERR_RATE_LIMITED);
+    r->addHeader("Retry-After", String((unsigned)(1.0f + (1.0f - t) / RATE_LIMITS[cls].per_sec)));
+    req->send(r);
+    return false;
+  }
+  e->tokens[cls] = t - 1.0f;
+  return true;
+}
+
+void forgetClients() {
+  for (int i = 0; i < MAX_CLIENTS; i++) g_clients[i].ip = 0;
+}
+
+// -------- Admin auth helpers --------
+static String getHeader(AsyncWebServerRequest *req, const char* name) {
+  if (req->hasHeader(name)) return req->getHeader(name)->value();
+  return String();
+}
+
+static bool parseBasicAuth(const String& auth, String &user, String &pass) {
+  if (!auth.startsWith("Basic ")) return false;
+  String b64 = auth.substring(6);
+  size_t needed = 0;
+  // First call to learn required length
+  mbedtls_base64_decode(nullptr, 0, &needed,
+                        (const unsigned char*)b64.c_str(), b64.length());
+  if (needed == 0) return false;
+  std::vector<unsigned char> buf(needed + 1);
+  size_t olen = 0;
+  if (mbedtls_base64_decode(buf.data(), needed, &olen,
+                            (const unsigned char*)b64.c_str(), b64.length()) != 0) return false;
+  buf[olen] = 0;
+  String decoded = String((const char*)buf.data());
+  int colon = decoded.indexOf(':');
+  if (colon < 0) return false;
+  user = decoded.substring(0, colon);
+  pass = decoded.substring(colon + 1);
+  return true;
+}
+
+// -------- Password hashing + sessions --------
+// Stored admin and team PIN hashes: "pbkdf2$<iterations>$<salt hex>$<key hex>"
+// (PBKDF2-HMAC-SHA256). A bare 64-char hex value is a legacy unsalted sha256
+// and is upgraded on the next successful login, as is a hash stored with a
+// different iteration count than the current one for its kind. The check runs
+// in the async_tcp callback, once per login; the client then presents a random
+// session token that adminGuard()/sessionTeam() validate with a constant-time
+// scan of one table shared by both roles. Sessions live only on the async_tcp
+// task.
+//
+// Team PINs use far fewer iterations: a 4-6 digit PIN has at most 10^6
+// values, so no count the board could afford would slow an offline search of
+// a stolen snapshot; the salt still rules out precomputed tables, and online
+// guessing is bounded by RL_AUTH. Registrations and logins (including the
+// dummy check for unknown names) then cost a few ms instead of holding the
+// network task for most of a second at match start.
+
+#define PBKDF2_ITERATIONS      4096    // admin password
+#define PIN_PBKDF2_ITERATIONS  128     // team PINs, see above
+#define PBKDF2_SALT_LEN        16
+#define SESSION_TOKEN_LEN      32      // hex chars
+#define MAX_SESSIONS           128     // roughly one per player device, plus admins
+#define SESSION_TTL_S          (8 * 3600)
+#define SESSION_COOKIE         "scv_session"
+#define TEAM_SESSION_COOKIE    "scv_team"
+#define LOGIN_MAX_FAILURES     5       // then back off exponentially
+#define LOGIN_BACKOFF_MAX_S    300
+
+static void toHex(const uint8_t* in, size_t n, char* out) {
+  static const char* hex="0123456789abcdef";
+  for (size_t i = 0; i < n; i++) { out[2*i] = hex[in[i]>>4]; out[2*i+1] = hex[in[i]&0xF]; }
+  out[2*n] = 0;
+}
+
+static bool fromHex(const String& in, uint8_t* out, size_t n) {
+  if (in.length() != 2*n) return false;
+  for (size_t i = 0; i < 2*n; i++) {
+    char c = in[i];
+    int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+    if (v < 0) return false;
+    if (i & 1) out[i/2] |= v; else out[i/2] = v << 4;
+  }
+  return true;
 }
 
-function loadTeamItems(){
-  if(!team_id) return;
-  j({team_id:team_id},'/api/team/items',function(r){
-    var tb=id('itemsBody');
-    tb.innerHTML='';
-    var items=(r&&r.items)||[];
-    for(var i=0;i<items.length;i++){
-      var it=items[i];
-      var found=!!it.found;
-      var st=found ? '<span class="status-found">Found</span>' : '<span class="status-miss">Missing</span>';
-      tb.insertAdjacentHTML('beforeend',
-        '<tr><td>'+escapeHtml(it.name)+'</td><td>'+(it.points||0)+'</td><td>'+st+'</td></tr>');
+static bool pbkdf2Sha256(const String& pass, const uint8_t* salt, size_t saltLen, uint32_t iters, uint8_t out[32]) {
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  bool ok = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0 &&
+            mbedtls_pkcs5_pbkdf2_hmac(&ctx, (const unsigned char*)pass.c_str(), pass.length(),
+                                      salt, saltLen, iters, 32, out) == 0;
+  mbedtls_md_free(&ctx);
+  return ok;
+}
+
+String hashPassword(const String& pass, uint32_t iters = PBKDF2_ITERATIONS) {
+  uint8_t salt[PBKDF2_SALT_LEN], key[32];
+  esp_fill_random(salt, sizeof(salt));
+  if (!pbkdf2Sha256(pass, salt, sizeof(salt), iters, key)) return String();
+  char saltHex[2*PBKDF2_SALT_LEN+1], keyHex[65];
+  toHex(salt, sizeof(salt), saltHex);
+  toHex(key, sizeof(key), keyHex);
+  return String("pbkdf2$") + String((unsigned)iters) + "$" + saltHex + "$" + keyHex;
+}
+
+// Verify pass against a stored hash; sets legacy when it should be re-hashed
+// (an old unsalted sha256, or an iteration count other than wantIters).
+bool verifyPassword(const String& pass, const String& stored, bool* legacy = nullptr,
+                    uint32_t wantIters = PBKDF2_ITERATIONS) {
+  if (legacy) *legacy = false;
+  if (!stored.startsWith("pbkdf2$")) {
+    if (legacy) *legacy = true;
+    return stored.length() > 0 && consttime_eq(sha256Hex(pass), stored);
+  }
+  int a = stored.indexOf('$', 7), b = (a < 0) ? -1 : stored.indexOf('$', a + 1);
+  if (a < 0 || b < 0) return false;
+  uint32_t iters = (uint32_t)stored.substring(7, a).toInt();
+  uint8_t salt[PBKDF2_SALT_LEN], want[32], got[32];
+  if (iters == 0 || !fromHex(stored.substring(a + 1, b), salt, sizeof(salt)) ||
+      !fromHex(stored.substring(b + 1), want, sizeof(want))) return false;
+  if (!pbkdf2Sha256(pass, salt, sizeof(salt), iters, got)) return false;
+  if (legacy) *legacy = iters != wantIters;
+  return consttime_eq((const char*)got, sizeof(got), (const char*)want, sizeof(want));
+}
+
+// Login throttle, per client IP (kept in its ClientEntry): every failure past
+// LOGIN_MAX_FAILURES doubles that client's wait, and only its own success
+// clears it, so a phone guessing passwords can't lock the organizers out.
+static bool loginThrottled(AsyncWebServerRequest *req) {
+  return millis()/1000 < clientEntry(req)->login_blocked_until;
+}
+
+static void noteLoginResult(AsyncWebServerRequest *req, bool ok) {
+  ClientEntry* e = clientEntry(req);
+  if (ok) { e->login_failures = 0; e->login_blocked_until = 0; return; }
+  if (e->login_failures < 0xFFFF) e->login_failures++;
+  if (e->login_failures < LOGIN_MAX_FAILURES) return;
+  uint32_t shift = e->login_failures - LOGIN_MAX_FAILURES;
+  uint32_t wait = (shift >= 9) ? LOGIN_BACKOFF_MAX_S : (1u << shift);
+  if (wait > LOGIN_BACKOFF_MAX_S) wait = LOGIN_BACKOFF_MAX_S;
+  e->login_blocked_until = millis()/1000 + wait;
+}
+
+enum SessionRole : uint8_t { ROLE_NONE, ROLE_ADMIN, ROLE_TEAM };
+
+struct Session {
+  char token[SESSION_TOKEN_LEN + 1] = {0};
+  uint32_t expires_at = 0;   // seconds since boot; 0 => free
+  uint8_t role = ROLE_NONE;
+  String team_id;            // ROLE_TEAM only
+};
+static Session g_sessions[MAX_SESSIONS];
+
+// A free/expired slot, else the oldest of the same role, so players signing
+// in can never push the organizers out (and vice versa unless the table is
+// all one role).
+String createSession(uint8_t role = ROLE_ADMIN, const String& teamId = String()) {
+  uint32_t now = millis()/1000;
+  int slot = -1, oldest = 0;
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    if (g_sessions[i].expires_at <= now) { slot = i; break; }
+    if (g_sessions[i].expires_at < g_sessions[oldest].expires_at) oldest = i;
+    if (g_sessions[i].role == role &&
+        (slot < 0 || g_sessions[i].expires_at < g_sessions[slot].expires_at)) slot = i;
+  }
+  if (slot < 0) slot = oldest;
+  Session &s = g_sessions[slot];
+  uint8_t rnd[SESSION_TOKEN_LEN / 2];
+  esp_fill_random(rnd, sizeof(rnd));
+  toHex(rnd, sizeof(rnd), s.token);
+  s.expires_at = now + SESSION_TTL_S;
+  s.role = role;
+  s.team_id = role == ROLE_TEAM ? teamId : String();
+  return String(s.token);
+}
+
+// Constant-time over the whole table: no early exit on a match.
+static int findSession(const char* tok, size_t len, uint8_t role) {
+  uint32_t now = millis()/1000;
+  int hit = -1;
+  for (int i = 0; i < MAX_SESSIONS; i++) {
+    bool eq = consttime_eq(g_sessions[i].token, SESSION_TOKEN_LEN, tok, len);
+    if (eq && g_sessions[i].expires_at > now && g_sessions[i].role == role) hit = i;
+  }
+  return hit;
+}
+
+static void dropSession(Session& s) {
+  s.expires_at = 0; s.token[0] = 0; s.role = ROLE_NONE; s.team_id = String();
+}
+
+void dropAllSessions() {
+  for (auto &s : g_sessions) dropSession(s);
+}
+
+// Team sessions for one team id, or for every team when id is null.
+void dropTeamSessions(const String* id) {
+  for (auto &s : g_sessions)
+    if (s.role == ROLE_TEAM && (!id || s.team_id == *id)) dropSession(s);
+}
+
+// Session token from "Authorization: Bearer ..." or the role's cookie.
+static String requestSessionToken(AsyncWebServerRequest *req, const char* cookieName = SESSION_COOKIE) {
+  String auth = getHeader(req, "Authorization");
+  if (auth.startsWith("Bearer ")) return auth.substring(7);
+  String cookie = getHeader(req, "Cookie");
+  String key = String(cookieName) + "=";
+  int at = cookie.indexOf(key.c_str());
+  if (at < 0) return String();
+  at += key.length();
+  int end = cookie.indexOf(';', at);
+  return end < 0 ? cookie.substring(at) : cookie.substring(at, end);
+}
+
+// Reply with {ok, token, expires_in[, team_id]} and set the session cookie.
+void sendSessionCreated(AsyncWebServerRequest *req, const String& token,
+                        const char* cookieName = SESSION_COOKIE, const String& teamId = String()) {
+  RequestDoc d(DOC_SMALL);
+  d["ok"] = true; d["token"] = token; d["expires_in"] = SESSION_TTL_S;
+  if (teamId.length()) d["team_id"] = teamId;
+  String out; serializeJson(d, out);
+  AsyncWebServerResponse* r = req->beginResponse(200, "application/json; charset=utf-8", out);
+  r->addHeader("Set-Cookie", String(cookieName) + "=" + token +
+               "; Path=/; HttpOnly; SameSite=Strict; Max-Age=" + String((unsigned)SESSION_TTL_S));
+  req->send(r);
+}
+
+// Check an admin password (with throttling and legacy-hash upgrade).
+static bool checkAdminPassword(AsyncWebServerRequest *req, const String& pass) {
+  if (loginThrottled(req)) return false;
+  String stored;
+  { StateLock lock; stored = g_config.admin_hash; }
+  bool legacy = false;
+  bool ok = verifyPassword(pass, stored, &legacy);
+  noteLoginResult(req, ok);
+  if (ok && legacy) {
+    String upgraded = hashPassword(pass);
+    if (upgraded.length()) {
+      { StateLock lock; g_config.admin_hash = upgraded; }
+      markDirty(DIRTY_CONFIG);
     }
-  });
+  }
+  return ok;
+}
+
+// The last Authorization header that passed checkAdminPassword(), as its
+// sha256 and bound to the admin hash it was checked against, so a script
+// sending Basic auth with every call pays the PBKDF2 once per
+// BASIC_AUTH_CACHE_S instead of on every request.
+#define BASIC_AUTH_CACHE_S 600
+
+static struct {
+  String header_sha;
+  uint32_t admin_fnv;
+  uint32_t until;   // seconds since boot
+} g_basicAuthOk;
+
+static uint32_t adminHashFnv() {
+  StateLock lock;
+  return fnv1a(g_config.admin_hash.c_str(), g_config.admin_hash.length());
+}
+
+static bool basicAuthCached(const String& header) {
+  if (!g_basicAuthOk.header_sha.length() || millis()/1000 >= g_basicAuthOk.until) return false;
+  return g_basicAuthOk.admin_fnv == adminHashFnv() && consttime_eq(sha256Hex(header), g_basicAuthOk.header_sha);
+}
+
+static void rememberBasicAuth(const String& header) {
+  g_basicAuthOk.header_sha = sha256Hex(header);
+  g_basicAuthOk.admin_fnv = adminHashFnv();
+  g_basicAuthOk.until = millis()/1000 + BASIC_AUTH_CACHE_S;
+}
+
+static bool adminGuard(AsyncWebServerRequest *req) {
+  // Allow first-time setup without auth
+  if (g_config.admin_hash.length() == 0) return true;
+
+  String tok = requestSessionToken(req);
+  if (tok.length() && findSession(tok.c_str(), tok.length(), ROLE_ADMIN) >= 0) return true;
+
+  // HTTP Basic still works for scripts; the full password check runs only
+  // for a header that isn't the one verified last
+  String auth = getHeader(req, "Authorization");
+  if (auth.length() && basicAuthCached(auth)) return true;
+  String u, p;
+  if (parseBasicAuth(auth, u, p) && checkAdminPassword(req, p)) { rememberBasicAuth(auth); return true; }
+
+  // No WWW-Authenticate: the admin page shows its own login form on 401
+  sendError(req, 401, ERR_AUTH);
+  return false;
+}
+
+// -------- Team PINs --------
+// Same PBKDF2 format as the admin password at PIN_PBKDF2_ITERATIONS, so a PIN
+// can't be looked up in a precomputed table. Logins for unknown names verify
+// against a throwaway hash, so every attempt costs the same.
+
+static String hashPin(const String& pin) { return hashPassword(pin, PIN_PBKDF2_ITERATIONS); }
+
+static const String& dummyPinHash() {
+  static String h;
+  if (h.length() == 0) h = hashPin("000000");
+  return h;
 }
 
-function submitCode(){
-  var token = val('codeword').trim();
-  if(!team_id){ toast('Please register/login first.'); return; }
-  if(!token){ toast('Enter a codeword'); return; }
-  busy(true);
-  j({team_id:team_id, token:token},'/api/team/submit_code',function(r){
-    busy(false);
-    if(r && r.ok){
-      toast('+'+(r.awarded||0)+' pts! Total: '+(r.total||0));
-      id('codeword').value='';
-      loadTeamItems(); loadLB();
-    }else if(r && r.duplicate){
-      toast('Already found.');
-      loadTeamItems();
-    }else{
-      toast(JSON.stringify(r));
+// Check name/pin; on success returns the team id (empty on failure). A legacy
+// sha256 PIN, or one hashed at another iteration count, is re-hashed and the
+// teams snapshot rewritten once.
+String checkTeamPin(const String& name, const String& pin) {
+  String stored, id;
+  {
+    StateLock lock;
+    Team* t = findTeamByName(name);
+    if (t) { stored = t->pin_hash; id = t->id; }
+  }
+  bool legacy = false;
+  bool ok = verifyPassword(pin, stored.length() ? stored : dummyPinHash(), &legacy, PIN_PBKDF2_ITERATIONS) &&
+            stored.length();
+  if (!ok) return String();
+  if (legacy) {
+    String upgraded = hashPin(pin);
+    if (upgraded.length()) {
+      StateLock lock;
+      Team* t = findTeamById(id);
+      if (t && t->pin_hash == stored) { t->pin_hash = upgraded; markDirty(DIRTY_TEAMS); }
     }
+  }
+  return id;
+}
+
+// Team behind the request's session (Bearer token or team cookie), or nullptr
+// after replying 401. Call under StateLock; the pointer is only good while it's held.
+static Team* sessionTeam(AsyncWebServerRequest *req) {
+  String tok = requestSessionToken(req, TEAM_SESSION_COOKIE);
+  int i = tok.length() ? findSession(tok.c_str(), tok.length(), ROLE_TEAM) : -1;
+  Team* t = i >= 0 ? findTeamById(g_sessions[i].team_id) : nullptr;
+  if (!t) sendError(req, 401, ERR_AUTH);
+  return t;
+}
+
+// ------------------ HTML & PWA (gzipped at build time) ------------------
+// Pages live in web/ and are gzipped into include/web_assets.h by
+// tools/embed_web.py. They are streamed from flash as-is; every browser we
+// target accepts gzip, so no uncompressed copy is kept.
+
+static const String& assetETag() {
+  static String etag;
+  if (etag.length() == 0) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "\"%08x\"", (unsigned)fnv1a(FW_VERSION, strlen(FW_VERSION)));
+    etag = buf;
+  }
+  return etag;
+}
+
+static bool etagMatches(AsyncWebServerRequest *req, const char* etag) {
+  return req->hasHeader("If-None-Match") && req->getHeader("If-None-Match")->value().indexOf(etag) >= 0;
+}
+
+static void sendStaticAsset(AsyncWebServerRequest *req, const uint8_t* gz, size_t len,
+                            const char* type, const char* cacheControl) {
+  const String& etag = assetETag();
+  AsyncWebServerResponse* r;
+  if (etagMatches(req, etag.c_str())) {
+    r = req->beginResponse(304);
+  } else {
+    r = req->beginResponse(200, type, gz, len);
+    r->addHeader("Content-Encoding", "gzip");
+  }
+  r->addHeader("ETag", etag);
+  r->addHeader("Cache-Control", cacheControl);
+  req->send(r);
+}
+
+void addCaptiveRoute() {
+  server.on("/captive", HTTP_GET, [](AsyncWebServerRequest *req){
+    sendStaticAsset(req, WEB_CAPTIVE_HTML_GZ, WEB_CAPTIVE_HTML_GZ_LEN, "text/html", "no-cache");
   });
 }
 
-// --- tiny UX helpers ---
-var _busy=0;
-function busy(on){
-  _busy = on ? (_busy+1) : Math.max(0,_busy-1);
-  document.body.style.cursor = _busy ? 'progress' : '';
-}
-function toast(msg){
-  try{ console.log('[toast]', msg); alert(msg); }catch(e){}
-}
-function escapeHtml(s){
-  if(s==null) return '';
-  return String(s)
-    .replace(/&/g,'&amp;')
-    .replace(/</g,'&lt;')
-    .replace(/>/g,'&gt;')
-    .replace(/"/g,'&quot;')
-    .replace(/'/g,'&#39;');
-}
-
-// init
-loadLB();
-setInterval(loadLB,6000);
-</script>
-
-</body></html>)HTML";
-
-// Admin (wording tuned) + NEW Teams management section
-static const char HTML_ADMIN[] PROGMEM = R"ADMIN(<!doctype html><html><head>
-<meta charset="utf-8"/><meta name="viewport" content="width=device-width,initial-scale=1"/>
-<title>Scavenger Admin</title>
-<style>
-body{font-family:system-ui;margin:16px}
-.row{display:flex;gap:8px;flex-wrap:wrap;margin-bottom:8px}
-input,button{font-size:1rem;padding:8px;border-radius:8px;border:1px solid #bbb}
-button{background:#222;color:#fff;border:0;cursor:pointer;transition:transform .04s ease,filter .04s ease}
-button.ghost{background:#f3f3f3;color:#111;border:1px solid #ccc}
-button:active{transform:translateY(1px);filter:brightness(0.92)}
-table{width:100%;border-collapse:collapse;margin-top:8px}
-th,td{border:1px solid #ddd;padding:6px;text-align:left}
-.small{color:#555}
-.badge{background:#eee;border-radius:999px;padding:2px 8px;margin-left:6px}
-.danger{background:#b00020;color:#fff;border-color:#8a0019}
-</style>
-
-</head><body>
-<h1>Admin</h1>
-
-<div id="first">
-  <p><b>First-time setup:</b> set password</p>
-  <div class="row">
-    <input id="pass" type="password" placeholder="New admin password">
-    <button onclick="setup()">Save</button>
-  </div>
-</div>
-
-<hr>
-<h3>Game Wi-Fi</h3>
-<p class="small">This SSID will be used when switching to GAME mode (open network, no password).</p>
-<div class="row">
-  <input id="game_ssid" placeholder="Game SSID">
-  <button onclick="saveSSID()">Save SSID</button>
-</div>
-
-<hr>
-<h3>Checkpoints <span class="badge" id="count"></span></h3>
-<p class="small">Add one row per item. <b>Token</b> is the exact codeword. Points default to 10.</p>
-<div class="row">
-  <button onclick="addRow()">Add item</button>
-  <button onclick="save()">Save all</button>
-  <button onclick="reload()">Reload</button>
-  <button class="ghost" onclick="factory(false)">Reset to organizer (keep items)</button>
-  <button class="ghost" onclick="factory(true)">Factory reset (wipe all)</button>
-</div>
-<table id="tbl">
-  <thead><tr><th>Name</th><th>Token (codeword)</th><th>Points</th><th></th></tr></thead>
-  <tbody id="rows"></tbody>
-</table>
-
-<hr>
-<h3>Teams</h3>
-<p class="small">Manage registered teams. You can remove a single team or wipe all teams between groups.</p>
-<div class="row">
-  <button class="danger" onclick="wipeTeams()">Wipe All Teams</button>
-  <span id="teamsStatus" class="small"></span>
-</div>
-<table id="teamsTbl">
-  <thead><tr><th>ID</th><th>Name</th><th>Points</th><th>Found</th><th>Created</th><th></th></tr></thead>
-  <tbody id="teamsRows"><tr><td colspan="6"><i>Loading…</i></td></tr></tbody>
-</table>
-
-<hr>
-<h3>Mode</h3>
-<div class="row">
-  <button onclick="mode('setup')">Switch to SETUP mode</button>
-  <button onclick="mode('game')">Switch to GAME mode</button>
-</div>
-
-<script>
-function setup(){
-  fetch('/api/admin/setup',{method:'POST',headers:{'Content-Type':'application/json'},
-    body:JSON.stringify({pass:document.getElementById('pass').value})})
-    .then(r=>r.json()).then(x=>alert(JSON.stringify(x)));
-}
-
-function saveSSID(){
-  const ssid = document.getElementById('game_ssid').value.trim();
-  fetch('/api/admin/game_ssid',{method:'POST',headers:{'Content-Type':'application/json'},
-    body:JSON.stringify({ssid})})
-    .then(r=>r.json()).then(x=>alert(JSON.stringify(x)));
-}
-
-function rowHtml(n='',t='',p=10){
-  return `<tr>
-    <td><input value="${n}" placeholder="Name" maxlength="40"></td>
-    <td><input value="${t}" placeholder="Token (codeword)" maxlength="64"></td>
-    <td><input value="${p}" type="number" min="1" max="1000" style="width:90px"></td>
-    <td><button onclick="this.closest('tr').remove()">✕</button></td>
-  </tr>`;
-}
-
-function addRow(){ document.getElementById('rows').insertAdjacentHTML('beforeend', rowHtml()); }
-
-function reload(){
-  fetch('/api/admin/checkpoints').then(r=>r.json()).then(x=>{
-    const tb=document.getElementById('rows'); tb.innerHTML='';
-    const items=(x.items||[]);
-    items.forEach(i=>tb.insertAdjacentHTML('beforeend', rowHtml(i.name,i.token_text,i.points)));
-    document.getElementById('count').textContent = items.length + ' items';
+// ------------------ Captive probe responder ------------------
+// OS connectivity probes used to get a 302 to /captive, which then bounced to
+// /app from JS: three round trips per probe, and phones probe a lot. Now a
+// station that has not loaded a portal page yet gets a tiny page that
+// refreshes straight to the landing page by absolute URL (so the app always
+// runs on the AP's origin), and a station that already has gets the exact
+// answer its OS expects for "online", which stops the re-probing and closes
+// the sign-in sheet. All bodies are constant strings or built once per AP.
+
+enum ProbeOS : uint8_t { PROBE_ANDROID, PROBE_APPLE, PROBE_WINDOWS, PROBE_FIREFOX, PROBE_OS_COUNT };
+static const char* const PROBE_OS_NAMES[PROBE_OS_COUNT] = { "android", "apple", "windows", "firefox" };
+
+struct ProbeRoute {
+  const char* path;
+  ProbeOS os;
+  int ok_code;
+  const char* ok_type;
+  const char* ok_body;           // what the OS treats as "connected"
+};
+
+static const char PROBE_APPLE_OK[] =
+  "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>";
+
+static const ProbeRoute PROBE_ROUTES[] = {
+  { "/generate_204",               PROBE_ANDROID, 204, "text/plain", "" },
+  { "/gen_204",                    PROBE_ANDROID, 204, "text/plain", "" },
+  { "/hotspot-detect.html",        PROBE_APPLE,   200, "text/html",  PROBE_APPLE_OK },
+  { "/library/test/success.html",  PROBE_APPLE,   200, "text/html",  PROBE_APPLE_OK },
+  { "/ncsi.txt",                   PROBE_WINDOWS, 200, "text/plain", "Microsoft NCSI" },
+  { "/connecttest.txt",            PROBE_WINDOWS, 200, "text/plain", "Microsoft Connect Test" },
+  { "/success.txt",                PROBE_FIREFOX, 200, "text/plain", "success\n" },
+};
+
+struct ProbeStats {
+  uint32_t portal[PROBE_OS_COUNT];     // answered with the portal page
+  uint32_t connected[PROBE_OS_COUNT];  // answered "online" from the onboarded cache
+  uint32_t not_found;                  // unknown URLs redirected to the landing page
+};
+static ProbeStats g_probeStats = {};
+
+static void markOnboarded(AsyncWebServerRequest *req) {
+  clientEntry(req)->onboarded = true;
+}
+
+static const char* landingPath() {
+  return (g_config.mode == MODE_SETUP) ? "/admin" : "/app";
+}
+
+// Absolute landing URL plus the portal page; rebuilt only when mode or AP IP changes
+static const String& landingURL() {
+  static String url;
+  static Mode builtMode = MODE_SETUP;
+  static uint32_t builtIp = 0;
+  uint32_t ip = (uint32_t)WiFi.softAPIP();
+  if (url.length() == 0 || builtMode != g_config.mode || builtIp != ip) {
+    url = String("http://") + WiFi.softAPIP().toString() + landingPath();
+    builtMode = g_config.mode;
+    builtIp = ip;
+  }
+  return url;
+}
+
+static const String& probePortalBody() {
+  static String body;
+  static String builtFor;
+  const String& url = landingURL();
+  if (builtFor != url) {
+    body = String("<!doctype html><meta http-equiv=\"refresh\" content=\"0;url=") + url +
+           "\"><title>Scavenger Hunt</title><a href=\"" + url + "\">Open the game</a>";
+    builtFor = url;
+  }
+  return body;
+}
+
+static void answerProbe(AsyncWebServerRequest *req, const ProbeRoute& p) {
+  AsyncWebServerResponse* r;
+  if (clientEntry(req)->onboarded) {
+    g_probeStats.connected[p.os]++;
+    r = req->beginResponse(p.ok_code, p.ok_type, p.ok_body);
+  } else {
+    g_probeStats.portal[p.os]++;
+    r = req->beginResponse(200, "text/html", probePortalBody());
+  }
+  r->addHeader("Cache-Control", "no-store");
+  req->send(r);
+}
+
+void registerCaptiveHandlersOnce(AsyncWebServer& s) {
+  static bool done = false;
+  if (done) return;
+  for (const ProbeRoute& p : PROBE_ROUTES) {
+    const ProbeRoute* route = &p;
+    s.on(p.path, HTTP_ANY, [route](AsyncWebServerRequest *r){ answerProbe(r, *route); });
+  }
+  s.onNotFound([](AsyncWebServerRequest *r){
+    g_probeStats.not_found++;
+    r->redirect(landingURL());
+  });
+  done = true;
+}
+
+// ------------------ Live updates (SSE) ------------------
+// /api/events pushes "leaderboard" (same body as /api/leaderboard) whenever the
+// visible top list changes, and "progress" {tag} on every award. The stream
+// is public, so a progress event names the team only by an opaque tag (a
+// keyed hash of its id, the key random per boot); a page learns its own tag
+// from its authenticated /api/team/items reply and refetches only on a match.
+// Both are sent from the engine task; leaderboard pushes are coalesced to one
+// per LIVE_PUSH_MIN_MS. Past MAX_SSE_CLIENTS the stream answers 503 and the
+// page keeps polling.
+
+#define MAX_SSE_CLIENTS  24
+#define LIVE_PUSH_MIN_MS 500
+
+#define PROGRESS_TAG_LEN 8
+
+AsyncEventSource g_events("/api/events");
+
+static uint32_t g_progressKey = 0;   // set once in setupLiveEvents()
+
+// out[PROGRESS_TAG_LEN+1]: hex of fnv1a(key, team id)
+static void progressTag(const String& teamId, char* out) {
+  char buf[8 + 40 + 1];
+  int n = snprintf(buf, sizeof(buf), "%08x%s", (unsigned)g_progressKey, teamId.c_str());
+  if (n < 0 || n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+  snprintf(out, PROGRESS_TAG_LEN + 1, "%08x", (unsigned)fnv1a(buf, n));
+}
+
+static void pushTeamProgress(const char* tag) {
+  if (g_events.count() == 0) return;
+  char buf[32];
+  snprintf(buf, sizeof(buf), "{\"tag\":\"%s\"}", tag);
+  g_events.send(buf, "progress");
+}
+
+static void pushLiveUpdates() {
+  static uint32_t lastPush = 0;
+  if (millis() - lastPush < LIVE_PUSH_MIN_MS) return;
+  if (g_leaderboardPushedVersion == g_leaderboardSnapVersion) return;
+  g_leaderboardPushedVersion = g_leaderboardSnapVersion;
+  if (g_events.count() == 0) return;
+  LeaderboardSnap json = leaderboardSnapshot();
+  lastPush = millis();
+  g_events.send(json->c_str(), "leaderboard");
+}
+
+void setupLiveEvents() {
+  g_progressKey = esp_random();
+  g_events.onConnect([](AsyncEventSourceClient *client){
+    client->send(leaderboardSnapshot()->c_str(), "leaderboard");
   });
-  fetch('/api/admin/status').then(r=>r.json()).then(x=>{
-    if (x.game_ssid) document.getElementById('game_ssid').value=x.game_ssid;
+  g_events.setFilter([](AsyncWebServerRequest*){ return g_events.count() < MAX_SSE_CLIENTS; });
+  server.addHandler(&g_events);
+  // Reached only when the filter above turns a client away
+  server.on("/api/events", HTTP_GET, [](AsyncWebServerRequest *req){
+    req->send(503, "text/plain", "busy");
   });
-  loadTeams();
 }
 
-function save(){
-  const rows=[...document.querySelectorAll('#rows tr')];
-  const items = rows.map(tr=>{
-    const ins=[...tr.querySelectorAll('input')];
-    const n=ins[0].value.trim(), t=ins[1].value.trim(), p=parseInt(ins[2].value||'10')||10;
-    return {id:'',name:n,token_text:t,points:p};
-  }).filter(i=>i.name && i.token_text);
-  fetch('/api/admin/checkpoints',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(items)})
-    .then(r=>r.json()).then(x=>{ alert(JSON.stringify(x)); reload(); });
+// ------------------ Engine task ------------------
+// Core split: Wi-Fi, lwIP and async_tcp run on core 0 (CONFIG_ASYNC_TCP_RUNNING_CORE
+// in platformio.ini). Handlers there make the state change itself under
+// StateLock (token lookup, bitset, journal line: microseconds) and answer.
+// Everything that fans out from a change runs here on core 1: the leaderboard
+// snapshot, "progress" and "leaderboard" SSE pushes. Handlers post commands
+// by value and never wait on this task; the persistence task shares core 1 at
+// a lower priority.
+
+#define ENGINE_TASK_STACK 6144
+#define ENGINE_QUEUE_LEN  32
+#define ENGINE_TICK_MS    100   // how stale the leaderboard snapshot can get
+
+enum EngineOp : uint8_t { ENGINE_PROGRESS };
+
+struct EngineCmd {
+  EngineOp op;
+  char tag[PROGRESS_TAG_LEN + 1];
+};
+
+static QueueHandle_t g_engineQueue = nullptr;
+static TaskHandle_t g_engineTask = nullptr;
+static struct { uint32_t posted, processed, dropped; } g_engineStats = {};
+
+static bool postEngine(const EngineCmd& cmd) {
+  if (!g_engineQueue || xQueueSend(g_engineQueue, &cmd, 0) != pdTRUE) {
+    g_engineStats.dropped++;   // queue full: the next leaderboard push still carries the score
+    return false;
+  }
+  g_engineStats.posted++;
+  return true;
+}
+
+// Caller holds StateLock; the command carries a copy, not the Team
+static void postTeamProgress(const Team& t) {
+  EngineCmd cmd;
+  cmd.op = ENGINE_PROGRESS;
+  progressTag(t.id, cmd.tag);
+  postEngine(cmd);
 }
 
-function mode(m){
-  fetch('/api/admin/mode',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify({mode:m})})
-    .then(r=>r.json()).then(x=>alert(JSON.stringify(x)));
+static void engineTask(void*) {
+  EngineCmd cmd;
+  for (;;) {
+    if (xQueueReceive(g_engineQueue, &cmd, pdMS_TO_TICKS(ENGINE_TICK_MS)) == pdTRUE) {
+      do {
+        if (cmd.op == ENGINE_PROGRESS) pushTeamProgress(cmd.tag);
+        g_engineStats.processed++;
+      } while (xQueueReceive(g_engineQueue, &cmd, 0) == pdTRUE);
+    }
+    publishLeaderboard();
+    pushLiveUpdates();
+  }
 }
 
-function factory(all){
-  fetch('/api/admin/factory_reset',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify({wipe_all:all})})
-    .then(r=>r.json()).then(x=>alert(JSON.stringify(x)));
+void startEngine() {
+  g_engineQueue = xQueueCreate(ENGINE_QUEUE_LEN, sizeof(EngineCmd));
+  xTaskCreatePinnedToCore(engineTask, "engine", ENGINE_TASK_STACK, nullptr, 2, &g_engineTask, APP_CPU_NUM);
 }
 
-// ---- Teams UI ----
-function loadTeams(){
-  fetch('/api/admin/teams').then(r=>r.json()).then(x=>{
-    const rows = document.getElementById('teamsRows');
-    rows.innerHTML = '';
-    const t = (x && x.teams) || [];
-    if (t.length === 0){
-      rows.innerHTML = '<tr><td colspan="6"><i>No teams yet</i></td></tr>';
+// ------------------ Submission pipeline ------------------
+// One path for every codeword submission: session team, token index lookup,
+// bitset test, award, journal. Request fields stay as const char* into the
+// parsed document, which lives in a pooled arena; the reply String is the
+// only heap allocation left.
+
+enum SubmitStatus { SUBMIT_AWARDED, SUBMIT_DUPLICATE, SUBMIT_NO_TEAM, SUBMIT_EMPTY_TOKEN, SUBMIT_NO_MATCH };
+
+struct SubmitResult {
+  SubmitStatus status;
+  Team* team = nullptr;
+  Checkpoint* checkpoint = nullptr;
+};
+
+SubmitResult submitToken(Team* team, const char* token) {
+  SubmitResult r;
+  r.team = team;
+  if (!r.team) { r.status = SUBMIT_NO_TEAM; return r; }
+  size_t len = strlen(token);
+  while (len > 0 && isspace((unsigned char)*token)) { token++; len--; }
+  while (len > 0 && isspace((unsigned char)token[len-1])) len--;
+  if (len == 0) { r.status = SUBMIT_EMPTY_TOKEN; return r; }
+  r.checkpoint = findCheckpointByToken(token, len);
+  if (!r.checkpoint) { r.status = SUBMIT_NO_MATCH; return r; }
+  if (!teamAddFound(*r.team, *r.checkpoint)) { r.status = SUBMIT_DUPLICATE; return r; }
+  journalTeamFound(*r.team, r.checkpoint->id);
+  postTeamProgress(*r.team);
+  r.status = SUBMIT_AWARDED;
+  return r;
+}
+
+static void handleSubmitBody(AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (!admit(req, RL_SUBMIT, index)) return;
+  const uint8_t* body; size_t bodyLen;
+  if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+  RequestDoc d(DOC_SMALL);
+  if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
+  StateLock lock;
+  Team* team = sessionTeam(req);
+  if (!team) return;
+  SubmitResult r = submitToken(team, d["token"] | "");
+  switch (r.status) {
+    case SUBMIT_NO_TEAM:     { sendError(req, 404, ERR_TEAM_NOT_FOUND); return; }
+    case SUBMIT_EMPTY_TOKEN: { sendError(req, 400, ERR_EMPTY_TOKEN); return; }
+    case SUBMIT_NO_MATCH:    { sendError(req, 404, ERR_NO_MATCH); return; }
+    case SUBMIT_DUPLICATE: {
+      RequestDoc e(DOC_SMALL); e["ok"]=true; e["duplicate"]=true; e["points"]=r.team->points; sendJSON(req,200,e); return;
+    }
+    case SUBMIT_AWARDED: {
+      RequestDoc ok(DOC_SMALL);
+      ok["ok"]=true; ok["awarded"]=r.checkpoint->points; ok["total"]=r.team->points; ok["checkpoint_id"]=r.checkpoint->id;
+      sendJSON(req,200,ok);
       return;
     }
-    t.forEach(item=>{
-      rows.insertAdjacentHTML('beforeend',
-        `<tr>
-          <td>${item.id||''}</td>
-          <td>${escapeHtml(item.name||'')}</td>
-          <td>${item.points||0}</td>
-          <td>${item.found||0}</td>
-          <td>${item.created_at||0}</td>
-          <td><button class="ghost" onclick="delTeam('${item.id||''}')">Delete</button></td>
-        </tr>`);
-    });
-  }).catch(()=>{ document.getElementById('teamsRows').innerHTML='<tr><td colspan="6">Failed to load</td></tr>';});
-}
-
-function delTeam(id){
-  if(!id) return;
-  if(!confirm('Delete team '+id+'?')) return;
-  fetch('/api/admin/teams/'+encodeURIComponent(id), { method:'DELETE' })
-    .then(r=>r.json()).then(()=>loadTeams())
-    .catch(()=>alert('Delete failed'));
-}
-
-function wipeTeams(){
-  if(!confirm('Wipe ALL teams? This cannot be undone.')) return;
-  document.getElementById('teamsStatus').textContent = 'Wiping…';
-  fetch('/api/admin/teams/wipe', { method:'POST' })
-    .then(r=>r.json()).then(()=>{ document.getElementById('teamsStatus').textContent='Done.'; loadTeams(); })
-    .catch(()=>{ document.getElementById('teamsStatus').textContent='Failed.'; });
-}
-
-function escapeHtml(s){
-  if(s==null) return '';
-  return String(s)
-    .replace(/&/g,'&amp;').replace(/</g,'&lt;').replace(/>/g,'&gt;')
-    .replace(/"/g,'&quot;').replace(/'/g,'&#39;');
-}
-
-reload();
-</script>
-</body></html>)ADMIN";
-
-// ---------- Captive landing page (auto-redirects to /app) ----------
-static const char HTML_CAPTIVE[] PROGMEM = R"HTML(
-<!doctype html><html><head>
-<meta charset="utf-8"/>
-<meta name="viewport" content="width=device-width,initial-scale=1"/>
-<title>Scavenger Hunt Wi-Fi</title>
-<style>
-  body{font-family:system-ui,-apple-system,Segoe UI,Roboto,Ubuntu,Helvetica,Arial,sans-serif;
-       text-align:center;padding:2rem;background:#fafafa;color:#111}
-  a.button{display:inline-block;margin-top:1.25rem;padding:1rem 1.5rem;background:#222;color:#fff;
-           border-radius:12px;text-decoration:none;font-size:1.05rem;transition:transform .04s ease,filter .04s ease}
-  a.button:active{transform:translateY(1px);filter:brightness(0.92)}
-  p{max-width:460px;margin:1rem auto;color:#555;line-height:1.4}
-  code{background:#eee;padding:.1rem .3rem;border-radius:6px}
-</style>
-<script>
-setTimeout(()=>{ try{ location.replace('/app'); }catch(e){} }, 600);
-</script>
-</head><body>
-  <h1>You’re connected 🎉</h1>
-  <p>This is the Wi-Fi sign-in screen. The game portal should open automatically. If not, tap below.</p>
-  <a class="button" href="/app" rel="noopener">Open Game Portal</a>
-  <p>If that doesn’t open, manually go to <code>http://192.168.4.1</code> in your browser.</p>
-</body></html>
-)HTML";
-
-String htmlCaptive() { return FPSTR(HTML_CAPTIVE); }
-void addCaptiveRoute() {
-  server.on("/captive", HTTP_GET, [](AsyncWebServerRequest *req){
-    req->send(200, "text/html", htmlCaptive());
-  });
+  }
 }
 
-static const char SW_JS[] PROGMEM = R"SW(
-const CACHE = 'scv-v3';
-self.addEventListener('install', e => {
-  e.waitUntil(caches.open(CACHE).then(c => c.addAll(['/app','/api/items'])));
-  self.skipWaiting();
-});
-self.addEventListener('activate', e => {
-  e.waitUntil(
-    caches.keys().then(keys => Promise.all(keys.filter(k => k !== CACHE).map(k => caches.delete(k))))
-  );
-  self.clients.claim();
-});
-self.addEventListener('fetch', e => {
-  const u = new URL(e.request.url);
-  if (u.pathname === '/api/items') {
-    e.respondWith(
-      fetch(e.request).then(r => {
-        const cc = r.clone();
-        caches.open(CACHE).then(c => c.put(e.request, cc));
-        return r;
-      }).catch(() => caches.match(e.request))
-    );
-    return;
+// ------------------ Checkpoint tables ------------------
+// Every path that replaces the checkpoint list (the admin form, bulk import)
+// builds the new table beside the old one and installs it here in one step.
+
+// Validate one record into c; false if it can't be a checkpoint. Points may
+// be 0 but not negative: a find never lowers a score. Ids are taken as given
+// only if saneCheckpointId() accepts them.
+static bool makeCheckpoint(const String& id, const String& name, const String& token, int points,
+                           Checkpoint& c) {
+  if (points < 0) return false;
+  c.token_text = token;
+  c.token_text.trim();
+  if (!saneToken(c.token_text)) return false;
+  c.id = id.length() ? id : newId("C");
+  if (!saneCheckpointId(c.id)) return false;
+  c.name = sanitizeName(name);
+  c.points = points;
+  return true;
+}
+
+// A backup's checkpoint list (see /api/admin/import) into `next`, held to the
+// same rules as an upload: each through makeCheckpoint(), ids and codewords
+// unique. Every entry needs its id, since the teams' finds refer to it.
+// Returns how many entries were refused; the caller installs nothing unless
+// that is 0.
+static uint32_t checkpointsForRestore(JsonArray arr, std::vector<Checkpoint>& next) {
+  uint32_t rejected = 0;
+  for (JsonObject o : arr) {
+    Checkpoint c;
+    String id = JV_toString(o["id"], "");
+    bool ok = id.length() && next.size() < MAX_CHECKPOINTS &&
+              makeCheckpoint(id, JV_toString(o["name"], ""),
+                             JV_toString(o["token_text"], ""), int(o["points"] | 10), c) &&
+              checkpointUnique(next, c);
+    if (ok) next.push_back(c); else rejected++;
   }
-  if (u.pathname === '/app') {
-    e.respondWith(
-      caches.match('/app').then(r => r || fetch(e.request))
-    );
-    return;
+  return rejected;
+}
+
+// Swap `next` in (caller holds StateLock) and persist it; see replaceCheckpoints().
+static void installCheckpoints(std::vector<Checkpoint>& next) {
+  replaceCheckpoints(next);
+  markDirty(DIRTY_CHECKPOINTS);
+}
+
+// ------------------ Bulk checkpoint import/export ------------------
+// POST /api/admin/checkpoints/import takes NDJSON (one {"id","name",
+// "token_text","points"} object per line) or CSV (Content-Type text/csv;
+// optional header row naming the columns, default order id,name,token_text,
+// points). Records are parsed line by line as body chunks arrive, so a
+// 500-item hunt needs one line buffer plus the new table, never the whole
+// body (the parser lives in lib/engine). The table is installed only once the
+// last chunk is in, and only if every line was accepted: an upload with
+// rejected lines is refused with 400 unless ?partial=1, and an empty one
+// unless ?replace=1, since installing it would wipe finds and scores. One
+// import runs at a time (async_tcp task only).
+//
+// GET /api/admin/checkpoints/export?format=csv|ndjson streams the same
+// formats back, one row per chunk fill.
+
+// Records go through makeCheckpoint() like the admin form's.
+static bool importMake(const char* id, const char* name, const char* token, int points, Checkpoint& c) {
+  return makeCheckpoint(String(id), String(name), String(token), points, c);
+}
+
+struct ImportUpload {
+  AsyncWebServerRequest* req = nullptr;
+  CheckpointImport im;
+};
+static ImportUpload* g_import = nullptr;
+
+static void endImport() {
+  delete g_import;
+  g_import = nullptr;
+}
+
+static void handleCheckpointImport(AsyncWebServerRequest *req, uint8_t *data, size_t len,
+                                   size_t index, size_t total) {
+  if (index == 0) {
+    if (!adminGuard(req)) return;
+    if (g_import) { sendError(req, 409, ERR_BUSY); return; }
+    g_import = new (std::nothrow) ImportUpload();
+    if (!g_import) { sendError(req, 503, ERR_NO_MEMORY); return; }
+    g_import->req = req;
+    g_import->im.make = importMake;
+    String type = req->contentType();
+    if (type.indexOf("csv") >= 0)       { g_import->im.fmt = BULK_CSV;    g_import->im.sniff = false; }
+    else if (type.indexOf("json") >= 0) { g_import->im.fmt = BULK_NDJSON; g_import->im.sniff = false; }
+    // A client that hangs up mid-upload leaves nothing behind
+    req->onDisconnect([req]{ if (g_import && g_import->req == req) endImport(); });
+  }
+  if (!g_import || g_import->req != req) return;
+  CheckpointImport* im = &g_import->im;
+
+  {
+    RequestDoc scratch(DOC_SMALL);
+    importFeed(*im, data, len, scratch);
+    if (index + len < total) return;
+    importFinish(*im, scratch);
   }
-});
-)SW";
 
-static const char MANIFEST_JSON[] PROGMEM = R"MANI({
-  "name": "Scavenger",
-  "short_name": "Scavenger",
-  "start_url": "/app",
-  "display": "standalone",
-  "background_color": "#ffffff",
-  "theme_color": "#222222",
-  "icons": []
-})MANI";
+  RequestDoc ok(DOC_SMALL);
+  bool install = importInstallable(*im, req->hasParam("partial"), req->hasParam("replace"));
+  if (install) {
+    StateLock lock;
+    installCheckpoints(im->next);
+    ok["ok"] = true;
+    ok["count"] = (int)g_checkpoints.size();
+  } else {
+    ok["error"] = im->next.empty() ? "empty_import" : "rejected_lines";
+  }
+  ok["rejected"] = im->rejected;
+  if (im->rejected) ok["first_rejected_line"] = im->firstRejected;
+  endImport();
+  sendJSON(req, install ? 200 : 400, ok);
+}
+
+// Line-oriented chunked writer: `head`, then row(i) for each index as the TCP
+// window allows (same shape as JsonListStream).
+typedef std::function<size_t(size_t i, char* out, size_t cap)> LineRowFn;  // 0 => skip row
+
+struct LineStream {
+  LineStream()  { g_streamsInFlight++; }
+  ~LineStream() { g_streamsInFlight--; }
+  JsonCountFn count;
+  LineRowFn row;
+  String head;
+  size_t next = 0;
+  bool headDone = false;
+  char pending[2 * IMPORT_LINE_MAX];
+  size_t pendLen = 0, pendOff = 0;
+
+  bool produce() {
+    pendLen = pendOff = 0;
+    while (pendLen == 0) {
+      if (!headDone) {
+        headDone = true;
+        pendLen = head.length() < sizeof(pending) ? head.length() : sizeof(pending);
+        memcpy(pending, head.c_str(), pendLen);
+      } else if (next < count()) {
+        pendLen = row(next++, pending, sizeof(pending));
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+};
 
-// ------------------ HTTP Routes ------------------
+// Append s as a CSV field (quoted if needed); false if it doesn't fit.
+static bool csvField(char* out, size_t cap, size_t& n, const char* s, bool last) {
+  bool quote = strpbrk(s, ",\"\r\n") != nullptr;
+  if (quote) { if (n >= cap) return false; out[n++] = '"'; }
+  for (; *s; s++) {
+    if (n + 2 >= cap) return false;
+    if (*s == '"') out[n++] = '"';
+    out[n++] = *s;
+  }
+  if (n + 2 >= cap) return false;
+  if (quote) out[n++] = '"';
+  out[n++] = last ? '\n' : ',';
+  return true;
+}
 
-String htmlIndex() { return FPSTR(HTML_INDEX); }
-String htmlAdmin() { return FPSTR(HTML_ADMIN); }
-String pwaManifest() { return FPSTR(MANIFEST_JSON); }
-String pwaServiceWorker() { return FPSTR(SW_JS); }
+static void sendCheckpointExport(AsyncWebServerRequest *req) {
+  bool csv = req->hasParam("format") && req->getParam("format")->value() == "csv";
+  auto st = std::make_shared<LineStream>();
+  st->count = []{ return g_checkpoints.size(); };
+  if (csv) {
+    st->head = "id,name,token_text,points\n";
+    st->row = [](size_t i, char* out, size_t cap) -> size_t {
+      const Checkpoint &c = g_checkpoints[i];
+      char pts[12];
+      snprintf(pts, sizeof(pts), "%d", c.points);
+      size_t n = 0;
+      bool ok = csvField(out, cap, n, c.id.c_str(), false) && csvField(out, cap, n, c.name.c_str(), false) &&
+                csvField(out, cap, n, c.token_text.c_str(), false) && csvField(out, cap, n, pts, true);
+      return ok ? n : 0;
+    };
+  } else {
+    st->row = [](size_t i, char* out, size_t cap) -> size_t {
+      const Checkpoint &c = g_checkpoints[i];
+      RequestDoc doc(DOC_SMALL);
+      doc["id"]=c.id; doc["name"]=c.name; doc["token_text"]=c.token_text; doc["points"]=c.points;
+      if (measureJson(doc) + 1 >= cap) return 0;
+      size_t n = serializeJson(doc, out, cap);
+      out[n++] = '\n';
+      return n;
+    };
+  }
+  AsyncWebServerResponse* r = beginStream(req, csv ? "text/csv; charset=utf-8" : "application/x-ndjson", st);
+  r->addHeader("Content-Disposition", csv ? "attachment; filename=\"checkpoints.csv\""
+                                          : "attachment; filename=\"checkpoints.ndjson\"");
+  req->send(r);
+}
+
+// ------------------ Admin team pages ------------------
+// GET /api/admin/teams?offset=&limit=&sort=points|created_at|name&order=asc|desc
+//                     &prefix=<name prefix>&fields=id,name,points,found,created_at
+// Natural orders are best-first, oldest-first and A-Z; order=desc reverses them.
+// Pages are cut from orders the engine already keeps (the ranking, the name
+// order, and g_teams itself, which is registration order), so a refresh
+// serializes at most `limit` teams however many are registered. Only a prefix
+// filter on a non-name sort has to look at every name.
+#define TEAM_PAGE_DEFAULT 50
+#define TEAM_PAGE_MAX     200
+
+static const char* const TEAM_FIELDS[] = { "id", "name", "points", "found", "created_at" };
+#define TEAM_FIELD_COUNT 5
+#define TEAM_FIELDS_ALL  ((1 << TEAM_FIELD_COUNT) - 1)
+
+// Comma list of TEAM_FIELDS -> bitmask; empty or all-unknown means every field.
+static uint8_t parseTeamFields(const char* s) {
+  uint8_t mask = 0;
+  while (*s) {
+    size_t n = strcspn(s, ",");
+    for (int k = 0; k < TEAM_FIELD_COUNT; k++)
+      if (strlen(TEAM_FIELDS[k]) == n && !strncmp(s, TEAM_FIELDS[k], n)) mask |= 1 << k;
+    s += n;
+    if (*s) s++;
+  }
+  return mask ? mask : TEAM_FIELDS_ALL;
+}
+
+static String queryParam(AsyncWebServerRequest *req, const char* name) {
+  return req->hasParam(name) ? req->getParam(name)->value() : String();
+}
+
+static void sendTeamPage(AsyncWebServerRequest *req) {
+  String sort = queryParam(req, "sort"), prefix = queryParam(req, "prefix");
+  if (sort.length() && sort != "points" && sort != "created_at" && sort != "name") {
+    sendError(req, 400, ERR_BAD_FIELDS); return;
+  }
+  bool desc = queryParam(req, "order") == "desc";
+  long offset = queryParam(req, "offset").toInt();
+  if (offset < 0) offset = 0;
+  int limit = req->hasParam("limit") ? clampInt(queryParam(req, "limit").toInt(), 1, TEAM_PAGE_MAX)
+                                     : TEAM_PAGE_DEFAULT;
+  uint8_t fields = parseTeamFields(queryParam(req, "fields").c_str());
+  const char* pfx = prefix.c_str();
+  size_t plen = prefix.length();
+
+  // The page is fixed here as g_teams indices; chunks written later check
+  // g_teamsLayoutVersion so a delete mid-stream can't make them name other teams.
+  auto page = std::make_shared<std::vector<uint16_t>>();
+  size_t total = 0;
+  uint32_t layout;
+  {
+    StateLock lock;
+    const std::vector<uint16_t>* ord = nullptr;   // null: g_teams (registration) order
+    if (sort == "points") ord = &teamRanking();
+    else if (sort == "name") ord = &teamsByName();
+    size_t lo = 0, hi = g_teams.size();
+    bool scan = plen > 0;
+    if (scan && sort == "name") {
+      // name order sorts case-insensitively, so prefix matches are one run
+      auto below = [&](uint16_t i){ return strncasecmp(g_teams[i].name.c_str(), pfx, plen) < 0; };
+      auto within = [&](uint16_t i){ return strncasecmp(g_teams[i].name.c_str(), pfx, plen) <= 0; };
+      lo = std::partition_point(ord->begin(), ord->end(), below) - ord->begin();
+      hi = std::partition_point(ord->begin() + lo, ord->end(), within) - ord->begin();
+      scan = false;
+    }
+    auto at = [&](size_t k) -> uint16_t {
+      size_t pos = desc ? hi - 1 - k : lo + k;
+      return ord ? (*ord)[pos] : (uint16_t)pos;
+    };
+    if (scan) {
+      for (size_t k = 0; k < hi - lo; k++) {
+        uint16_t ix = at(k);
+        if (strncasecmp(g_teams[ix].name.c_str(), pfx, plen)) continue;
+        if (total >= (size_t)offset && page->size() < (size_t)limit) page->push_back(ix);
+        total++;
+      }
+    } else {
+      total = hi - lo;
+      for (size_t k = offset; k < total && page->size() < (size_t)limit; k++) page->push_back(at(k));
+    }
+    layout = g_teamsLayoutVersion;
+  }
+
+  String meta = String("\"total\":") + (unsigned)total + ",\"offset\":" + offset + ",\"limit\":" + limit;
+  sendJSONList(req, "teams", [page]{ return page->size(); }, [page, layout, fields](size_t i, JsonObject o){
+    if (layout != g_teamsLayoutVersion || (*page)[i] >= g_teams.size()) return false;
+    const Team &t = g_teams[(*page)[i]];
+    if (fields & 1)  o["id"] = t.id;
+    if (fields & 2)  o["name"] = t.name;
+    if (fields & 4)  o["points"] = t.points;
+    if (fields & 8)  o["found"] = t.found.count();
+    if (fields & 16) o["created_at"] = t.created_at;
+    return true;
+  }, meta);
+}
+
+// ------------------ Metrics ------------------
+// Every route in setupRoutes() is registered through route()/routeBody(),
+// which count requests and drop the handler's run time into fixed buckets.
+// Body routes are timed on the final chunk, where all the work happens;
+// streamed replies are counted when the stream is set up. A few adds and
+// compares per request, no allocation. AsyncTCP keeps its event queue
+// private, so /api/admin/metrics reports in-flight streams, SSE clients and
+// the async_tcp stack headroom as the load indicators instead.
+
+#define MAX_ROUTES 40
+static const uint32_t LATENCY_BOUNDS_US[] = { 500, 1000, 2000, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 };
+#define LATENCY_BUCKETS (sizeof(LATENCY_BOUNDS_US) / sizeof(LATENCY_BOUNDS_US[0]) + 1)  // last: slower
+
+struct RouteStat {
+  const char* method;
+  const char* path;
+  uint32_t count, total_us, max_us;
+  uint32_t buckets[LATENCY_BUCKETS];
+  void record(uint32_t us) {
+    count++;
+    total_us += us;
+    if (us > max_us) max_us = us;
+    size_t b = 0;
+    while (b < LATENCY_BUCKETS - 1 && us >= LATENCY_BOUNDS_US[b]) b++;
+    buckets[b]++;
+  }
+};
+static RouteStat g_routes[MAX_ROUTES];
+static size_t g_routeCount = 0;
+static RouteStat g_routeOverflow = { "*", "(unregistered)" };
+
+static const char* methodName(WebRequestMethodComposite m) {
+  switch (m) {
+    case HTTP_GET: return "GET";
+    case HTTP_POST: return "POST";
+    case HTTP_DELETE: return "DELETE";
+    default: return "ANY";
+  }
+}
+
+static RouteStat* registerRoute(const char* path, WebRequestMethodComposite m) {
+  if (g_routeCount >= MAX_ROUTES) return &g_routeOverflow;
+  RouteStat* rs = &g_routes[g_routeCount++];
+  rs->method = methodName(m);
+  rs->path = path;
+  return rs;
+}
+
+static void route(const char* path, WebRequestMethodComposite m, ArRequestHandlerFunction fn,
+                  const char* label = nullptr) {
+  RouteStat* rs = registerRoute(label ? label : path, m);
+  server.on(path, m, [rs, fn](AsyncWebServerRequest *req){
+    uint32_t t0 = micros();
+    fn(req);
+    rs->record(micros() - t0);
+  });
+}
+
+static void routeBody(const char* path, WebRequestMethodComposite m, ArBodyHandlerFunction fn) {
+  RouteStat* rs = registerRoute(path, m);
+  server.on(path, m, [](AsyncWebServerRequest *req){}, NULL,
+    [rs, fn](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      uint32_t t0 = micros();
+      fn(req, data, len, index, total);
+      if (index + len >= total) rs->record(micros() - t0);
+    });
+}
+
+static void addRouteMetrics(JsonArray arr, const RouteStat& rs) {
+  if (rs.count == 0 && &rs == &g_routeOverflow) return;
+  JsonObject o = arr.add<JsonObject>();
+  o["method"] = rs.method;
+  o["path"] = rs.path;
+  o["count"] = rs.count;
+  o["avg_us"] = rs.count ? rs.total_us / rs.count : 0;
+  o["max_us"] = rs.max_us;
+  JsonArray b = o["buckets"].to<JsonArray>();
+  for (size_t i = 0; i < LATENCY_BUCKETS; i++) b.add(rs.buckets[i]);
+}
+
+static void sendMetrics(AsyncWebServerRequest *req) {
+  RequestDoc d(DOC_LARGE);
+  d["uptime_s"] = (uint32_t)(millis() / 1000);
+
+  JsonObject heap = d["heap"].to<JsonObject>();
+  heap["free"] = ESP.getFreeHeap();
+  heap["min_free"] = ESP.getMinFreeHeap();
+  heap["largest_block"] = ESP.getMaxAllocHeap();
+  JsonObject arena = heap["doc_pool"].to<JsonObject>();
+  arena["leases"] = g_arenaStats.leases;
+  arena["exhausted"] = g_arenaStats.exhausted;
+  arena["spills"] = g_arenaStats.spills;
+
+  JsonObject net = d["net"].to<JsonObject>();
+  net["stations"] = WiFi.softAPgetStationNum();
+  apStatsToJson(net["ap"].to<JsonObject>());
+  net["dns_queries"] = g_dnsStats.queries;
+  net["dns_answered"] = g_dnsStats.answered;
+  net["sse_clients"] = g_events.count();
+  net["streams_in_flight"] = (uint32_t)g_streamsInFlight;
+  net["rate_limited"] = g_rateLimited;
+  TaskHandle_t tcp = xTaskGetHandle("async_tcp");
+  if (tcp) net["async_tcp_stack_free"] = (uint32_t)uxTaskGetStackHighWaterMark(tcp);
+
+  JsonObject eng = d["engine"].to<JsonObject>();
+  eng["posted"] = g_engineStats.posted;
+  eng["processed"] = g_engineStats.processed;
+  eng["dropped"] = g_engineStats.dropped;
+  if (g_engineQueue) eng["queued"] = (uint32_t)uxQueueMessagesWaiting(g_engineQueue);
+  if (g_engineTask) eng["stack_free"] = (uint32_t)uxTaskGetStackHighWaterMark(g_engineTask);
+
+  JsonObject flush = d["flush"].to<JsonObject>();
+  for (int k = 0; k < FLUSH_KINDS; k++) {
+    const FlushStat &st = g_flushStats[k];
+    JsonObject o = flush[FLUSH_NAMES[k]].to<JsonObject>();
+    o["count"] = st.count;
+    o["failures"] = st.failures;
+    o["avg_us"] = st.count ? st.total_us / st.count : 0;
+    o["max_us"] = st.max_us;
+    o["bytes"] = st.bytes;
+    if (k == FLUSH_CHECKPOINTS || k == FLUSH_TEAMS) {
+      const SnapshotSlots &sl = (k == FLUSH_TEAMS) ? g_teamSlots : g_checkpointSlots;
+      o["skipped"] = st.skipped;
+      o["seq"] = sl.seq;
+      o["slot"] = sl.newest < 0 ? "-" : (sl.newest == 0 ? "a" : "b");
+    }
+  }
+  flush["journal"]["on_flash_bytes"] = g_journalBytes;
+  flush["journal"]["fold_at_bytes"] = journalFoldBytes();
+
+  JsonArray bounds = d["latency_bounds_us"].to<JsonArray>();
+  for (uint32_t b : LATENCY_BOUNDS_US) bounds.add(b);
+  JsonArray routes = d["routes"].to<JsonArray>();
+  for (size_t i = 0; i < g_routeCount; i++) addRouteMetrics(routes, g_routes[i]);
+  addRouteMetrics(routes, g_routeOverflow);
+  sendJSON(req, 200, d);
+}
+
+// ------------------ HTTP Routes ------------------
 
 void setupRoutes() {
   // Root -> app or admin based on current mode
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *req){
+  route("/", HTTP_GET, [](AsyncWebServerRequest *req){
     if (g_config.mode == MODE_SETUP) req->redirect("/admin");
     else req->redirect("/app");
   });
 
-  // Static pages
-  server.on("/app", HTTP_GET, [](AsyncWebServerRequest *req){ req->send(200,"text/html", htmlIndex()); });
+  // Static pages (revalidated by ETag, so returning phones get a 304)
+  route("/app", HTTP_GET, [](AsyncWebServerRequest *req){
+    markOnboarded(req);
+    sendStaticAsset(req, WEB_APP_HTML_GZ, WEB_APP_HTML_GZ_LEN, "text/html", "no-cache");
+  });
 
-  // Protect /admin page after first-time setup
-  server.on("/admin", HTTP_GET, [](AsyncWebServerRequest *req){
-    if (!adminGuard(req)) return;
-    req->send(200,"text/html", htmlAdmin());
+  // The admin page itself holds no data; every /api/admin call is guarded and
+  // a 401 makes the page show its login form
+  route("/admin", HTTP_GET, [](AsyncWebServerRequest *req){
+    markOnboarded(req);
+    sendStaticAsset(req, WEB_ADMIN_HTML_GZ, WEB_ADMIN_HTML_GZ_LEN, "text/html", "private, no-cache");
   });
 
-  server.on("/manifest.webmanifest", HTTP_GET, [](AsyncWebServerRequest *req){ req->send(200,"application/manifest+json", pwaManifest()); });
-  server.on("/sw.js", HTTP_GET, [](AsyncWebServerRequest *req){ req->send(200,"application/javascript", pwaServiceWorker()); });
+  route("/manifest.webmanifest", HTTP_GET, [](AsyncWebServerRequest *req){
+    sendStaticAsset(req, WEB_MANIFEST_GZ, WEB_MANIFEST_GZ_LEN, "application/manifest+json", "public, max-age=86400");
+  });
+  route("/sw.js", HTTP_GET, [](AsyncWebServerRequest *req){
+    sendStaticAsset(req, WEB_SW_JS_GZ, WEB_SW_JS_GZ_LEN, "application/javascript", "no-cache");
+  });
 
   // ---- Admin ----
-  server.on("/api/admin/status", HTTP_GET, [](AsyncWebServerRequest *req){
+  route("/api/admin/status", HTTP_GET, [](AsyncWebServerRequest *req){
     if (!adminGuard(req)) return;
-    DynamicJsonDocument d(256);
+    StateLock lock;
+    RequestDoc d(DOC_SMALL);
     d["mode"] = (g_config.mode==MODE_GAME?"game":"setup");
     d["fw_version"] = FW_VERSION;
     d["stored_version"] = g_config.fw_version;
     d["game_ssid"] = g_config.game_ssid;
+    d["configured"] = g_config.admin_hash.length() > 0;
+    if (apSettings(g_config.mode).pass_rejected) {
+      d["ap_warning"] = "setup_pass in /config.json must be 8-63 characters; "
+                        "the setup AP is using the built-in default passphrase";
+    }
+    JsonObject probes = d["probes"].to<JsonObject>();
+    for (int i = 0; i < PROBE_OS_COUNT; i++) {
+      JsonObject o = probes[PROBE_OS_NAMES[i]].to<JsonObject>();
+      o["portal"] = g_probeStats.portal[i];
+      o["connected"] = g_probeStats.connected[i];
+    }
+    probes["not_found"] = g_probeStats.not_found;
+    JsonObject dns = d["dns"].to<JsonObject>();
+    dns["queries"] = g_dnsStats.queries;
+    dns["answered"] = g_dnsStats.answered;
+    dns["nodata"] = g_dnsStats.nodata;
+    dns["dropped"] = g_dnsStats.dropped;
+    JsonObject sw = d["switch"].to<JsonObject>();
+    sw["pending"] = g_switchTarget >= 0;
+    sw["count"] = g_switchStats.count;
+    sw["last_ms"] = g_switchStats.last_ms;
+    sw["in_place"] = g_switchStats.last_in_place;
     sendJSON(req,200,d);
   });
 
+  // Operator metrics: route latency, flash flushes, heap, Wi-Fi/DNS load
+  route("/api/admin/metrics", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!adminGuard(req)) return;
+    sendMetrics(req);
+  });
+
   // First-time password setter (unguarded until set)
-  server.on("/api/admin/setup", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
+  routeBody("/api/admin/setup", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
       if (g_config.admin_hash.length() > 0) {
-        DynamicJsonDocument doc(256); doc["error"]="already_configured";
-        sendJSON(req, 400, doc); return;
+        sendError(req, 400, ERR_ALREADY_CONFIGURED); return;
       }
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(512);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
       String pass = JV_toString(d["pass"], "");
-      if (pass.length() < 6) { DynamicJsonDocument e(128); e["error"]="weak_pass"; sendJSON(req,400,e); return; }
-      g_config.admin_hash = sha256Hex(pass);
-      saveConfig();
-      DynamicJsonDocument ok(64); ok["ok"]=true; sendJSON(req,200,ok);
+      if (pass.length() < 6) { sendError(req, 400, ERR_WEAK_PASS); return; }
+      String hash = hashPassword(pass);
+      if (hash.length() == 0) { sendError(req, 500, ERR_HASH_FAILED); return; }
+      { StateLock lock; g_config.admin_hash = hash; }
+      markDirty(DIRTY_CONFIG);
+      sendSessionCreated(req, createSession());   // already logged in on this browser
     });
 
+  // Admin login: {pass} -> session token (also set as a cookie)
+  routeBody("/api/admin/login", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (!admit(req, RL_AUTH, index)) return;
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
+      if (loginThrottled(req)) { sendError(req, 429, ERR_TOO_MANY_ATTEMPTS); return; }
+      if (!checkAdminPassword(req, JV_toString(d["pass"], ""))) { sendError(req, 403, ERR_AUTH); return; }
+      sendSessionCreated(req, createSession());
+    });
+
+  route("/api/admin/logout", HTTP_POST, [](AsyncWebServerRequest *req){
+    String tok = requestSessionToken(req);
+    int i = tok.length() ? findSession(tok.c_str(), tok.length(), ROLE_ADMIN) : -1;
+    if (i >= 0) dropSession(g_sessions[i]);
+    RequestDoc ok(DOC_SMALL); ok["ok"]=true; sendJSON(req,200,ok);
+  });
+
   // Update game_ssid
-  server.on("/api/admin/game_ssid", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
+  routeBody("/api/admin/game_ssid", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
       if (!adminGuard(req)) return;
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(256);
-      if (deserializeJson(d, body)) {
-        DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) {
+        sendError(req, 400, ERR_BAD_JSON); return;
       }
       String ssid = JV_toString(d["ssid"], "").substring(0, 31); // limit length
-      if (ssid.length()<1) { DynamicJsonDocument e(128); e["error"]="empty_ssid"; sendJSON(req,400,e); return; }
-      g_config.game_ssid = ssid;
-      saveConfig();
-      DynamicJsonDocument ok(64); ok["ok"]=true; ok["game_ssid"]=ssid; sendJSON(req,200,ok);
+      if (ssid.length()<1) { sendError(req, 400, ERR_EMPTY_SSID); return; }
+      { StateLock lock; g_config.game_ssid = ssid; }
+      markDirty(DIRTY_CONFIG);
+      RequestDoc ok(DOC_SMALL); ok["ok"]=true; ok["game_ssid"]=ssid; sendJSON(req,200,ok);
+    });
+
+  // Bulk checkpoint import/export (registered first: the plain
+  // /api/admin/checkpoints handlers would also match these sub-paths)
+  routeBody("/api/admin/checkpoints/import", HTTP_POST, handleCheckpointImport);
+  route("/api/admin/checkpoints/export", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!adminGuard(req)) return;
+    sendCheckpointExport(req);
+  });
+
+  // Game-AP radio profile; the game AP restarts to apply it
+  route("/api/admin/ap_profile", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!adminGuard(req)) return;
+    RequestDoc d(DOC_SMALL);
+    apProfileToJson(d["profile"].to<JsonObject>(), g_config.game_ap);
+    d["max_stations_limit"] = ESP_WIFI_MAX_CONN_NUM;
+    d["auto_channel"] = g_scan.best;
+    apStatsToJson(d["ap"].to<JsonObject>());
+    sendJSON(req,200,d);
+  });
+  routeBody("/api/admin/ap_profile", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      if (!adminGuard(req)) return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen) || !d.is<JsonObject>()) {
+        sendError(req, 400, ERR_BAD_JSON); return;
+      }
+      bool restart;
+      { StateLock lock; apProfileFromJson(d.as<JsonObject>(), g_config.game_ap); restart = g_config.mode == MODE_GAME; }
+      markDirty(DIRTY_CONFIG);
+      if (restart) requestAPSwitch(MODE_GAME);
+      RequestDoc ok(DOC_SMALL);
+      ok["ok"] = true;
+      ok["restarted"] = restart;
+      apProfileToJson(ok["profile"].to<JsonObject>(), g_config.game_ap);
+      sendJSON(req,200,ok);
     });
 
   // Admin checkpoints: POST save; GET list (for form)
-  server.on("/api/admin/checkpoints", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
+  routeBody("/api/admin/checkpoints", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
       if (!adminGuard(req)) return;
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(16384);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
-      g_checkpoints.clear();
+      RequestDoc d(DOC_LARGE);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
+      StateLock lock;
+      std::vector<Checkpoint> next;
       for (JsonObject o : d.as<JsonArray>()) {
+        if (next.size() >= MAX_CHECKPOINTS) break;
         Checkpoint c;
-        c.id         = JV_toString(o["id"], "");
-        if (c.id.length()==0) c.id = newId("C");
-        c.name       = sanitizeName(JV_toString(o["name"], ""));
-        c.token_text = JV_toString(o["token_text"], "");
-        c.token_text.trim();
-        if (!saneToken(c.token_text)) continue;
-        c.points     = int(o["points"] | 10);
-        g_checkpoints.push_back(c);
+        if (!makeCheckpoint(JV_toString(o["id"], ""), JV_toString(o["name"], ""),
+                            JV_toString(o["token_text"], ""), int(o["points"] | 10), c)) continue;
+        next.push_back(c);
       }
-      saveCheckpoints();
-      DynamicJsonDocument ok(64); ok["ok"]=true; ok["count"]= (int)g_checkpoints.size(); sendJSON(req,200,ok);
+      installCheckpoints(next);
+      RequestDoc ok(DOC_SMALL); ok["ok"]=true; ok["count"]= (int)g_checkpoints.size(); sendJSON(req,200,ok);
     });
 
-  server.on("/api/admin/checkpoints", HTTP_GET, [](AsyncWebServerRequest *req){
+  route("/api/admin/checkpoints", HTTP_GET, [](AsyncWebServerRequest *req){
     if (!adminGuard(req)) return;
-    DynamicJsonDocument d(8192);
-    JsonArray arr = d.createNestedArray("items");
-    for (auto &c : g_checkpoints) {
-      JsonObject o = arr.createNestedObject();
+    sendJSONList(req, "items", []{ return g_checkpoints.size(); }, [](size_t i, JsonObject o){
+      const Checkpoint &c = g_checkpoints[i];
       o["id"]=c.id; o["name"]=c.name; o["token_text"]=c.token_text; o["points"]=c.points;
-    }
-    sendJSON(req,200,d);
+      return true;
+    });
   });
 
   // ---------- NEW: Teams Admin API ----------
 
-  // List teams
-  server.on("/api/admin/teams", HTTP_GET, [](AsyncWebServerRequest *req){
+  // List teams, one page at a time (see sendTeamPage for the parameters)
+  route("/api/admin/teams", HTTP_GET, [](AsyncWebServerRequest *req){
     if (!adminGuard(req)) return;
-    // Ensure points are up to date
-    for (auto &t : g_teams) updatePointsFromFound(t);
-    DynamicJsonDocument d(16384);
-    JsonArray arr = d.createNestedArray("teams");
-    for (auto &t : g_teams) {
-      JsonObject o = arr.createNestedObject();
-      o["id"] = t.id;
-      o["name"] = t.name;
-      o["points"] = t.points;
-      o["found"] = (int)t.found.size();
-      o["created_at"] = t.created_at;
-    }
-    sendJSON(req,200,d);
+    sendTeamPage(req);
   });
 
   // Wipe all teams
-  server.on("/api/admin/teams/wipe", HTTP_POST, [](AsyncWebServerRequest *req){
+  route("/api/admin/teams/wipe", HTTP_POST, [](AsyncWebServerRequest *req){
     if (!adminGuard(req)) return;
+    StateLock lock;
     bool ok = wipeAllTeams();
-    DynamicJsonDocument d(64); d["ok"] = ok;
+    RequestDoc d(DOC_SMALL); d["ok"] = ok;
     sendJSON(req, ok ? 200 : 500, d);
   });
 
   // Delete one team
-  server.on("^\\/api\\/admin\\/teams\\/([A-Za-z0-9_\\-\\.]+)$", HTTP_DELETE,
+  route("^\\/api\\/admin\\/teams\\/([A-Za-z0-9_\\-\\.]+)$", HTTP_DELETE,
     [](AsyncWebServerRequest* req){
       if (!adminGuard(req)) return;
       String id = req->pathArg(0);
       if (id.isEmpty()) {
-        DynamicJsonDocument e(64); e["error"]="missing_id"; sendJSON(req,400,e); return;
+        sendError(req, 400, ERR_MISSING_ID); return;
       }
+      StateLock lock;
       bool ok = deleteTeamById(id);
-      DynamicJsonDocument d(64); d["ok"]=ok;
+      RequestDoc d(DOC_SMALL); d["ok"]=ok;
       sendJSON(req, ok?200:404, d);
+    }, "/api/admin/teams/<id>");
+
+  // Backup: checkpoints and teams as JSON (same shape as the old /checkpoints.json
+  // and /teams.json). Flash itself only holds the binary snapshots.
+  route("/api/admin/export", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!adminGuard(req)) return;
+    String out;
+    {
+      StateLock lock;
+      RequestDoc d(DOC_LARGE);
+      checkpointsToJson(d["checkpoints"].to<JsonArray>());
+      teamsToJson(d["teams"].to<JsonArray>());
+      serializeJson(d, out);
     }
-  );
+    AsyncWebServerResponse* r = req->beginResponse(200, "application/json; charset=utf-8", out);
+    r->addHeader("Content-Disposition", "attachment; filename=\"scavenger-backup.json\"");
+    req->send(r);
+  });
+
+  // Restore a backup from /api/admin/export; replaces all checkpoints and teams
+  routeBody("/api/admin/import", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      if (!adminGuard(req)) return;
+      RequestDoc d(DOC_LARGE);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
+      if (!d["checkpoints"].is<JsonArray>() || !d["teams"].is<JsonArray>()) {
+        sendError(req, 400, ERR_NEED_CHECKPOINTS_AND_TEAMS); return;
+      }
+      StateLock lock;
+      std::vector<Checkpoint> next;
+      uint32_t rejected = checkpointsForRestore(d["checkpoints"].as<JsonArray>(), next);
+      if (rejected) {
+        RequestDoc e(DOC_SMALL);
+        e["error"] = "rejected_checkpoints";
+        e["rejected"] = rejected;
+        sendJSON(req, 400, e);
+        return;
+      }
+      installCheckpoints(next);
+      teamsFromJson(d["teams"].as<JsonArray>());
+      dropTeamSessions(nullptr);   // restored teams must sign in again, as after a wipe
+      for (auto &t : g_teams) updatePointsFromFound(t);
+      rebuildRanking();
+      seedIdSequence();
+      markDirty(DIRTY_TEAMS);
+      RequestDoc ok(DOC_SMALL);
+      ok["ok"] = true;
+      ok["checkpoints"] = (int)g_checkpoints.size();
+      ok["teams"] = (int)g_teams.size();
+      sendJSON(req,200,ok);
+    });
 
   // Switch mode
-  server.on("/api/admin/mode", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
+  routeBody("/api/admin/mode", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
       if (!adminGuard(req)) return;
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(256);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
       String m = JV_toString(d["mode"], "");
-      if (m=="setup") { g_config.mode=MODE_SETUP; saveConfig(); switchAPNow(MODE_SETUP); }
-      else if (m=="game"){ g_config.mode=MODE_GAME; saveConfig(); switchAPNow(MODE_GAME); }
-      DynamicJsonDocument ok(64); ok["ok"]=true; ok["mode"]=m; sendJSON(req,200,ok);
+      if (m=="setup" || m=="game") {
+        Mode next = (m=="game") ? MODE_GAME : MODE_SETUP;
+        { StateLock lock; g_config.mode = next; }
+        // Runs from loop() once this reply is out; pending writes are flushed first
+        markDirty(DIRTY_CONFIG);
+        requestAPSwitch(next);
+      }
+      RequestDoc ok(DOC_SMALL); ok["ok"]=true; ok["mode"]=m; ok["switch_in_ms"]=AP_SWITCH_DELAY_MS; sendJSON(req,200,ok);
     });
 
   // Factory reset
-  server.on("/api/admin/factory_reset", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
+  routeBody("/api/admin/factory_reset", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
       if (!adminGuard(req)) return;
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(256);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
       bool wipeAll = bool(d["wipe_all"] | false);
       factoryReset(wipeAll);
-      DynamicJsonDocument ok(64); ok["ok"]=true; ok["wipe_all"]=wipeAll; sendJSON(req,200,ok);
+      RequestDoc ok(DOC_SMALL); ok["ok"]=true; ok["wipe_all"]=wipeAll; sendJSON(req,200,ok);
       delay(250);
       ESP.restart();
     });
@@ -1153,154 +3062,130 @@ void setupRoutes() {
   // ---- Player / Game APIs ----
 
   // Register team: {team_name, pin}
-  server.on("/api/register", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(512);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
+  routeBody("/api/register", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (!admit(req, RL_AUTH, index)) return;
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
       String name = sanitizeName(JV_toString(d["team_name"], ""));
       String pin  = JV_toString(d["pin"], "");
-      if (name.length()<1 || pin.length()<PIN_MINLEN || pin.length()>PIN_MAXLEN) { DynamicJsonDocument e(128); e["error"]="bad_fields"; sendJSON(req,400,e); return; }
-      if (findTeamByName(name)) { DynamicJsonDocument e(128); e["error"]="exists"; sendJSON(req,409,e); return; }
-      Team t; t.id=newId("T"); t.name=name; t.pin_hash=sha256Hex(pin); t.created_at=millis()/1000;
+      if (name.length()<1 || pin.length()<PIN_MINLEN || pin.length()>PIN_MAXLEN) { sendError(req, 400, ERR_BAD_FIELDS); return; }
+      { StateLock lock; if (findTeamByName(name)) { sendError(req, 409, ERR_EXISTS); return; } }
+      String pinHash = hashPin(pin);   // outside the lock
+      if (pinHash.length() == 0) { sendError(req, 500, ERR_HASH_FAILED); return; }
+      StateLock lock;
+      if (findTeamByName(name)) { sendError(req, 409, ERR_EXISTS); return; }
+      Team t; t.id=newId("T"); t.name=name; t.pin_hash=pinHash; t.created_at=millis()/1000;
       updatePointsFromFound(t);
       g_teams.push_back(t);
-      saveTeams();
-      DynamicJsonDocument ok(256); ok["ok"]=true; ok["team_id"]=t.id; sendJSON(req,200,ok);
+      teamIndexAdd(g_teams.size() - 1);
+      rankTeamAdded(g_teams.size() - 1);
+      journalTeamRegistered(t);
+      sendSessionCreated(req, createSession(ROLE_TEAM, t.id), TEAM_SESSION_COOKIE, t.id);
     });
 
-  // Login: {team_name, pin}
-  server.on("/api/login", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(512);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
+  // Login: {team_name, pin} -> {ok, token, team_id}; /api/team/* then needs the token
+  routeBody("/api/login", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (!admit(req, RL_AUTH, index)) return;
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
       String name = sanitizeName(JV_toString(d["team_name"], ""));
       String pin  = JV_toString(d["pin"], "");
-      Team* t = findTeamByName(name);
-      if (!t || !consttime_eq(sha256Hex(pin), t->pin_hash)) {
-        DynamicJsonDocument e(128); e["error"]="auth"; sendJSON(req,403,e); return;
-      }
-      DynamicJsonDocument ok(256); ok["ok"]=true; ok["team_id"]=t->id; sendJSON(req,200,ok);
+      String id = checkTeamPin(name, pin);
+      if (id.length() == 0) { sendError(req, 403, ERR_AUTH); return; }
+      sendSessionCreated(req, createSession(ROLE_TEAM, id), TEAM_SESSION_COOKIE, id);
     });
 
-  // Items list (PWA caches this)
-  server.on("/api/items", HTTP_GET, [](AsyncWebServerRequest *req){
-    DynamicJsonDocument d(8192);
-    JsonArray arr = d.createNestedArray("items");
-    for (auto &c : g_checkpoints) {
-      JsonObject o = arr.createNestedObject();
-      o["id"]=c.id; o["name"]=c.name; o["points"]=c.points;
+  // Items list (PWA caches this and revalidates with If-None-Match)
+  route("/api/items", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!admit(req, RL_READ)) return;
+    char etag[16];
+    { StateLock lock; snprintf(etag, sizeof(etag), "\"c%08x\"", (unsigned)g_checkpointsDigest); }
+    AsyncWebServerResponse* r;
+    if (etagMatches(req, etag)) {
+      r = req->beginResponse(304);
+    } else {
+      r = beginJSONList(req, "items", []{ return g_checkpoints.size(); }, [](size_t i, JsonObject o){
+        const Checkpoint &c = g_checkpoints[i];
+        o["id"]=c.id; o["name"]=c.name; o["points"]=c.points;
+        return true;
+      });
     }
-    sendJSON(req,200,d);
+    r->addHeader("ETag", etag);
+    r->addHeader("Cache-Control", "no-cache");
+    req->send(r);
   });
 
-  // Items list *for a team* with found/missing flags
-  server.on("/api/team/items", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(1024);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
-      String team_id = JV_toString(d["team_id"], "");
-      Team* t = findTeamById(team_id);
-      if (!t) { DynamicJsonDocument e(128); e["error"]="team_not_found"; sendJSON(req,404,e); return; }
-
-      DynamicJsonDocument out(16384);
-      JsonArray arr = out.createNestedArray("items");
-      for (auto &c : g_checkpoints) {
-        JsonObject o = arr.createNestedObject();
-        o["id"]=c.id; o["name"]=c.name; o["points"]=c.points;
-        o["found"]= teamFoundHas(*t, c.id);
+  // Items list *for the session's team* with found/missing flags: {since?}.
+  // Every reply carries the team's SSE "progress_tag" and "version"
+  // ("<checkpoints digest>.<find count>"); a
+  // client that sends it back as `since` gets {"delta":true,"items":[...]}
+  // with only the items found after it, or the full list if that isn't
+  // possible (checkpoints changed, reboot, too many finds in between).
+  routeBody("/api/team/items", HTTP_POST,
+    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t index, size_t total){
+      if (!admit(req, RL_READ, index)) return;
+      const uint8_t* body; size_t bodyLen;
+      if (!collectBody(req, data, len, index, total, body, bodyLen)) return;
+      RequestDoc d(DOC_SMALL);
+      if (deserializeJson(d, (const char*)body, bodyLen)) { sendError(req, 400, ERR_BAD_JSON); return; }
+      const char* since = d["since"] | "";
+      StateLock lock;
+      Team* t = sessionTeam(req);
+      if (!t) return;
+
+      char ver[24], tag[PROGRESS_TAG_LEN + 1];
+      snprintf(ver, sizeof(ver), "%08x.%d", (unsigned)g_checkpointsDigest, t->found.count());
+      progressTag(t->id, tag);
+      unsigned digest = 0; int seen = -1;
+      uint16_t fresh[RECENT_FINDS];
+      int n = -1;
+      if (sscanf(since, "%8x.%d", &digest, &seen) == 2 && digest == g_checkpointsDigest) {
+        n = teamFindsSince(*t, seen, fresh);
       }
-      sendJSON(req,200,out);
-    });
-
-  // Codeword submit (canonical)
-  server.on("/api/team/submit_code", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(1024);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
-      String team_id = JV_toString(d["team_id"], "");
-      String token   = JV_toString(d["token"], "");
-      Team* t = findTeamById(team_id);
-      if (!t) { DynamicJsonDocument e(128); e["error"]="team_not_found"; sendJSON(req,404,e); return; }
-      token.trim();
-      if (token.length()==0) { DynamicJsonDocument e(128); e["error"]="empty_token"; sendJSON(req,400,e); return; }
-
-      // Case-insensitive match convenience
-      Checkpoint* c = nullptr;
-      for (auto &cc : g_checkpoints) {
-        if (consttime_eq(cc.token_text, token)) { c = &cc; break; }
-        String a = cc.token_text; a.toLowerCase();
-        String b = token; b.toLowerCase();
-        if (a == b) { c = &cc; break; }
+      if (n >= 0) {
+        RequestDoc ok(DOC_SMALL);
+        ok["version"] = ver;
+        ok["progress_tag"] = tag;
+        ok["delta"] = true;
+        JsonArray arr = ok["items"].to<JsonArray>();
+        for (int k = 0; k < n; k++) {
+          const Checkpoint* c = findCheckpointBySlot(fresh[k]);
+          if (!c) continue;
+          JsonObject o = arr.add<JsonObject>();
+          o["id"]=c->id; o["name"]=c->name; o["points"]=c->points; o["found"]=true;
+        }
+        sendJSON(req,200,ok);
+        return;
       }
 
-      if (!c) { DynamicJsonDocument e(128); e["error"]="no_match"; sendJSON(req,404,e); return; }
-      if (teamFoundHas(*t, c->id)) {
-        DynamicJsonDocument e(256); e["ok"]=true; e["duplicate"]=true; e["points"]=t->points; sendJSON(req,200,e); return;
-      }
-      teamAddFound(*t, c->id, c->points);
-      saveTeams();
-
-      DynamicJsonDocument ok(256);
-      ok["ok"]=true; ok["awarded"]=c->points; ok["total"]=t->points; ok["checkpoint_id"]=c->id;
-      sendJSON(req,200,ok);
+      // Copy the bitset: t may not survive until the last chunk is written
+      FoundSet found = t->found;
+      sendJSONList(req, "items", []{ return g_checkpoints.size(); }, [found](size_t i, JsonObject o){
+        const Checkpoint &c = g_checkpoints[i];
+        o["id"]=c.id; o["name"]=c.name; o["points"]=c.points;
+        o["found"]= found.has(c.slot);
+        return true;
+      }, String("\"version\":\"") + ver + "\",\"progress_tag\":\"" + tag + "\",\"delta\":false");
     });
 
-  // Back-compat alias: allow old clients calling /scan_qr to behave the same
-  server.on("/api/team/scan_qr", HTTP_POST, [](AsyncWebServerRequest *req){}, NULL,
-    [](AsyncWebServerRequest *req, uint8_t *data, size_t len, size_t, size_t){
-      // Forward semantics to submit_code
-      String body = getBody(req, data, len);
-      DynamicJsonDocument d(1024);
-      if (deserializeJson(d, body)) { DynamicJsonDocument e(128); e["error"]="bad_json"; sendJSON(req,400,e); return; }
-      String team_id = JV_toString(d["team_id"], "");
-      String token   = JV_toString(d["token"], "");
-      Team* t = findTeamById(team_id);
-      if (!t) { DynamicJsonDocument e(128); e["error"]="team_not_found"; sendJSON(req,404,e); return; }
-      token.trim();
-      if (token.length()==0) { DynamicJsonDocument e(128); e["error"]="empty_token"; sendJSON(req,400,e); return; }
-
-      Checkpoint* c = nullptr;
-      for (auto &cc : g_checkpoints) {
-        if (consttime_eq(cc.token_text, token)) { c = &cc; break; }
-        String a2 = cc.token_text; a2.toLowerCase();
-        String b2 = token; b2.toLowerCase();
-        if (a2 == b2) { c = &cc; break; }
-      }
-
-      if (!c) { DynamicJsonDocument e(128); e["error"]="no_match"; sendJSON(req,404,e); return; }
-      if (teamFoundHas(*t, c->id)) {
-        DynamicJsonDocument e(256); e["ok"]=true; e["duplicate"]=true; e["points"]=t->points; sendJSON(req,200,e); return;
-      }
-      teamAddFound(*t, c->id, c->points);
-      saveTeams();
-
-      DynamicJsonDocument ok(256);
-      ok["ok"]=true; ok["awarded"]=c->points; ok["total"]=t->points; ok["checkpoint_id"]=c->id;
-      sendJSON(req,200,ok);
-    });
+  // Codeword submit (canonical) + back-compat alias for old clients calling /scan_qr
+  routeBody("/api/team/submit_code", HTTP_POST, handleSubmitBody);
+  routeBody("/api/team/scan_qr",     HTTP_POST, handleSubmitBody);
 
   // Leaderboard
-  server.on("/api/leaderboard", HTTP_GET, [](AsyncWebServerRequest *req){
-    for (auto &t : g_teams) updatePointsFromFound(t);
-    std::vector<Team> v = g_teams;
-    std::sort(v.begin(), v.end(), [](const Team&a,const Team&b){
-      if (a.points!=b.points) return a.points>b.points;
-      return a.created_at<b.created_at;
-    });
-    DynamicJsonDocument d(8192);
-    JsonArray arr = d.createNestedArray("teams");
-    int count = 0;
-    for (auto &t: v) {
-      JsonObject o = arr.createNestedObject();
-      o["name"]=t.name; o["points"]=t.points; o["found"]= (int)t.found.size();
-      if (++count>=LEADERBOARD_SIZE) break;
-    }
-    sendJSON(req,200,d);
+  route("/api/leaderboard", HTTP_GET, [](AsyncWebServerRequest *req){
+    if (!admit(req, RL_READ)) return;
+    req->send(200, "application/json; charset=utf-8", *leaderboardSnapshot());
   });
+
+  // Live leaderboard/progress stream (falls back to polling /api/leaderboard)
+  setupLiveEvents();
 }
 
 // ------------------ Mode management ------------------
@@ -1312,16 +3197,18 @@ void enterGameMode()  { startGameAP();  }
 
 void factoryReset(bool wipeAll) {
   if (wipeAll) {
+    discardPendingWrites();
     LittleFS.format();
     g_config.admin_hash = "";
     g_config.mode = MODE_SETUP;
     g_config.fw_version = FW_VERSION;
-    saveConfig();
   } else {
     g_config.admin_hash = "";
     g_config.mode = MODE_SETUP;
-    saveConfig();
   }
+  // Written before the reply, since the caller restarts right after
+  markDirty(DIRTY_CONFIG);
+  flushPersistence();
 }
 
 // ------------------ NEW: Teams admin helpers (impl) ------------------
@@ -1329,16 +3216,11 @@ void factoryReset(bool wipeAll) {
 bool wipeAllTeams() {
   // clear memory
   g_teams.clear();
-  // write empty array to file (keeps file present)
-  DynamicJsonDocument doc(8);
-  JsonArray arr = doc.to<JsonArray>();
-  String out; serializeJson(arr, out);
-  if (!writeStringToFile(FILE_TEAMS, out)) {
-    // as fallback, remove outright
-    removeIfExists(FILE_TEAMS);
-    // recreate empty array file
-    writeStringToFile(FILE_TEAMS, "[]");
-  }
+  dropTeamSessions(nullptr);
+  rebuildTeamIndex();
+  rebuildRanking();
+  // an empty snapshot (keeps the file present) supersedes any queued journal lines
+  markDirty(DIRTY_TEAMS);
   return true;
 }
 
@@ -1352,11 +3234,78 @@ bool deleteTeamById(const String& id) {
   }
   if (!changed) return false;
   g_teams.swap(keep);
-  return saveTeams();
+  dropTeamSessions(&id);
+  rebuildTeamIndex();
+  rebuildRanking();
+  return journalTeamDeleted(id);
 }
 
 // ------------------ Setup / Loop ------------------
 
+// ------------------ FS benchmark (build with -D FS_BENCHMARK) ------------------
+// Writes a /teams.json shaped like a busy event (FS_BENCH_TEAMS teams with
+// FS_BENCH_FOUND finds each), then times the old byte-at-a-time read and
+// single print() write against the block helpers above. Runs once at boot,
+// before loadAll(), and removes its file afterwards.
+#ifdef FS_BENCHMARK
+
+#define FS_BENCH_TEAMS 120
+#define FS_BENCH_FOUND 25
+#define FS_BENCH_RUNS  5
+
+static const char* FILE_BENCH = "/bench_teams.json";
+
+static bool legacyReadFileToString(const char* path, String &out) {
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  out.reserve(f.size()+8);
+  out = "";
+  while (f.available()) out += char(f.read());
+  f.close();
+  return true;
+}
+
+static bool legacyWriteStringToFile(const char* path, const String &data) {
+  File t = LittleFS.open(path, "w");
+  if (!t) return false;
+  size_t n = t.print(data);
+  t.close();
+  return n == data.length();
+}
+
+static void runFsBenchmark() {
+  String doc = "[";
+  for (int i = 0; i < FS_BENCH_TEAMS; i++) {
+    if (i) doc += ",";
+    doc += "{\"id\":\"T" + String(100000 + i) + "\",\"name\":\"Bench Team " + String(i) +
+           "\",\"pin_hash\":\"" + sha256Hex(String(i)) + "\",\"points\":" + String(i * 10) +
+           ",\"created_at\":" + String(1000 + i) + ",\"found\":[";
+    for (int j = 0; j < FS_BENCH_FOUND; j++) {
+      if (j) doc += ",";
+      doc += "\"C" + String(100 + j) + "\"";
+    }
+    doc += "]}";
+  }
+  doc += "]";
+
+  uint32_t us[4] = {0, 0, 0, 0};   // legacy read, block read, legacy write, block write
+  String s;
+  for (int r = 0; r < FS_BENCH_RUNS; r++) {
+    uint32_t t0 = micros(); legacyWriteStringToFile(FILE_BENCH, doc); us[2] += micros() - t0;
+    t0 = micros(); writeStringToFile(FILE_BENCH, doc);                 us[3] += micros() - t0;
+    t0 = micros(); legacyReadFileToString(FILE_BENCH, s);              us[0] += micros() - t0;
+    t0 = micros(); readFileToString(FILE_BENCH, s);                    us[1] += micros() - t0;
+  }
+  bool same = (s == doc);
+  removeIfExists(FILE_BENCH);
+  Serial.printf("[BENCH] %u bytes, %d runs: read %lu us -> %lu us, write %lu us -> %lu us%s\n",
+                (unsigned)doc.length(), FS_BENCH_RUNS,
+                (unsigned long)(us[0] / FS_BENCH_RUNS), (unsigned long)(us[1] / FS_BENCH_RUNS),
+                (unsigned long)(us[2] / FS_BENCH_RUNS), (unsigned long)(us[3] / FS_BENCH_RUNS),
+                same ? "" : " (READBACK MISMATCH)");
+}
+#endif
+
 void mountFS() {
   if (!LittleFS.begin(true)) {
     Serial.println("[FS] LittleFS mount failed");
@@ -1366,16 +3315,23 @@ void mountFS() {
 }
 
 void setup() {
+  g_loopTask = xTaskGetCurrentTaskHandle();   // setup() and loop() share the Arduino loop task
   Serial.begin(115200);
   delay(200);
 
   mountFS();
+#ifdef FS_BENCHMARK
+  runFsBenchmark();
+#endif
   loadAll();
+  startPersistence();
+  startEngine();
+  WiFi.onEvent(onApEvent);
 
   // If no admin password yet, force SETUP mode and persist it
   if (g_config.admin_hash.length() == 0) {
     g_config.mode = MODE_SETUP;
-    saveConfig();
+    markDirty(DIRTY_CONFIG);
   }
 
   if (g_config.mode == MODE_SETUP) enterSetupMode();
@@ -1391,6 +3347,9 @@ void setup() {
 }
 
 void loop() {
-  dnsServer.processNextRequest();
-  vTaskDelay(pdMS_TO_TICKS(10));  // portable and clear
+  // Periodic game work lives in the engine and persistence tasks; a mode
+  // switch request wakes us early
+  runPendingAPSwitch();
+  sampleApStations();
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
 }
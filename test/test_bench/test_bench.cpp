@@ -0,0 +1,494 @@
+// Engine invariants (ranking, find deltas, checkpoint replacement, digest,
+// snapshot checks) on small hand-built games, then benchmarks for the engine
+// hot paths (lib/engine) at 10/100/500 teams x 20/200 checkpoints of
+// synthetic data.
+//
+//   host:  pio test -e native -f test_bench
+//   board: pio test -e esp32dev_bench -f test_bench
+//
+// Each line reports cycles and allocations per operation and the peak heap
+// held while the operation ran. malloc/free/realloc/calloc are wrapped at link
+// time (see the --wrap flags in platformio.ini) and operator new/delete go
+// through them, so Strings, vectors and ArduinoJson pools are all counted.
+// Snapshot round trips are timed in memory; flash I/O is benchmarked
+// separately by FS_BENCHMARK in main.cpp.
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include "engine.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#else
+#include <malloc.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <chrono>
+#endif
+
+// ------------------ Allocation accounting ------------------
+
+extern "C" {
+void* __real_malloc(size_t n);
+void  __real_free(void* p);
+void* __real_realloc(void* p, size_t n);
+void* __real_calloc(size_t n, size_t sz);
+}
+
+struct AllocStats {
+  uint32_t allocs = 0;
+  long live = 0;       // bytes allocated minus freed since start
+  long peak = 0;       // high-water mark of live
+};
+static AllocStats g_alloc;
+static bool g_tracking = false;
+
+static size_t blockSize(void* p) {
+#ifdef ARDUINO
+  return heap_caps_get_allocated_size(p);
+#else
+  return malloc_usable_size(p);
+#endif
+}
+
+static void noteAlloc(void* p) {
+  if (!p || !g_tracking) return;
+  g_alloc.allocs++;
+  g_alloc.live += (long)blockSize(p);
+  if (g_alloc.live > g_alloc.peak) g_alloc.peak = g_alloc.live;
+}
+
+static void noteFree(void* p) {
+  if (p && g_tracking) g_alloc.live -= (long)blockSize(p);
+}
+
+extern "C" void* __wrap_malloc(size_t n) {
+  void* p = __real_malloc(n);
+  noteAlloc(p);
+  return p;
+}
+
+extern "C" void __wrap_free(void* p) {
+  noteFree(p);
+  __real_free(p);
+}
+
+extern "C" void* __wrap_realloc(void* p, size_t n) {
+  noteFree(p);
+  void* q = __real_realloc(p, n);
+  noteAlloc(q ? q : p);   // a failed realloc leaves p allocated
+  return q;
+}
+
+extern "C" void* __wrap_calloc(size_t n, size_t sz) {
+  void* p = __real_calloc(n, sz);
+  noteAlloc(p);
+  return p;
+}
+
+void* operator new(size_t n) { void* p = malloc(n); if (!p) abort(); return p; }
+void* operator new[](size_t n) { void* p = malloc(n); if (!p) abort(); return p; }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// ------------------ Timing ------------------
+
+static uint64_t cycles() {
+#ifdef ARDUINO
+  return ESP.getCycleCount();   // 32-bit counter: every timed block stays far below a wrap
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct Measure {
+  uint64_t c0;
+  Measure() { g_alloc = AllocStats(); g_tracking = true; c0 = cycles(); }
+  void report(const char* what, size_t teams, size_t chk, uint32_t ops, const char* extra = "") {
+    uint64_t c = cycles() - c0;
+    g_tracking = false;
+    printf("[bench] teams=%-3u chk=%-3u %-18s ops=%-5u cycles/op=%-9llu allocs/op=%-7.2f peak=%ldB %s\n",
+           (unsigned)teams, (unsigned)chk, what, (unsigned)ops,
+           (unsigned long long)(c / (ops ? ops : 1)), ops ? (double)g_alloc.allocs / ops : 0.0,
+           g_alloc.peak, extra);
+  }
+};
+
+// ------------------ Synthetic game ------------------
+
+static uint32_t g_seed = 12345;
+static uint32_t rnd() { g_seed = g_seed * 1103515245u + 12345u; return g_seed >> 8; }
+
+static void buildGame(size_t teams, size_t chk) {
+  char buf[80];
+  g_checkpoints.clear();
+  g_teams.clear();
+  g_checkpoints.reserve(chk);
+  for (size_t i = 0; i < chk; i++) {
+    Checkpoint c;
+    snprintf(buf, sizeof(buf), "C%05u", (unsigned)i);           c.id = buf;
+    snprintf(buf, sizeof(buf), "Riddle number %u", (unsigned)i); c.name = buf;
+    snprintf(buf, sizeof(buf), "Shiver Me Timbers %u", (unsigned)i); c.token_text = buf;
+    c.points = 10 + (int)(i % 5) * 5;
+    c.slot = (uint16_t)i;
+    g_checkpoints.push_back(c);
+  }
+  reindexCheckpoints();
+  g_teams.reserve(teams);
+  for (size_t i = 0; i < teams; i++) {
+    Team t;
+    snprintf(buf, sizeof(buf), "T%05u", (unsigned)i);            t.id = buf;
+    snprintf(buf, sizeof(buf), "Pirate Crew %u", (unsigned)i);    t.name = buf;
+    for (int k = 0; k < 64; k++) buf[k] = "0123456789abcdef"[rnd() & 15];
+    buf[64] = 0;                                                  t.pin_hash = buf;
+    t.created_at = (uint32_t)i;
+    for (size_t s = 0; s < chk; s++) if (rnd() % 100 < 30) t.found.set((uint16_t)s);
+    updatePointsFromFound(t);
+    g_teams.push_back(t);
+  }
+  rebuildRanking();
+}
+
+// ------------------ Invariants ------------------
+// Small hand-built games; each test starts from scratch.
+
+static Checkpoint checkpoint(const char* id, const char* token, int points, uint16_t slot) {
+  Checkpoint c;
+  c.id = id; c.name = id; c.token_text = token; c.points = points; c.slot = slot;
+  return c;
+}
+
+static void smallGame(const std::vector<Checkpoint>& chk, size_t teams) {
+  g_checkpoints = chk;
+  reindexCheckpoints();
+  g_teams.clear();
+  char buf[16];
+  for (size_t i = 0; i < teams; i++) {
+    Team t;
+    snprintf(buf, sizeof(buf), "T%u", (unsigned)i); t.id = buf; t.name = buf;
+    t.created_at = (uint32_t)i;
+    g_teams.push_back(t);
+  }
+  rebuildTeamIndex();
+  rebuildRanking();
+}
+
+static Checkpoint& byId(const char* id) {
+  Checkpoint* c = findCheckpointById(String(id));
+  TEST_ASSERT_NOT_NULL(c);
+  return *c;
+}
+
+static void assertRanking(const std::vector<uint16_t>& want) {
+  const std::vector<uint16_t>& got = teamRanking();
+  TEST_ASSERT_EQUAL_UINT32(want.size(), got.size());
+  for (size_t i = 0; i < want.size(); i++) TEST_ASSERT_EQUAL_UINT16(want[i], got[i]);
+}
+
+static void test_ranking_after_find(void) {
+  smallGame({ checkpoint("A", "alpha", 10, 0), checkpoint("B", "bravo", 20, 1),
+              checkpoint("Z", "zero", 0, 2) }, 3);
+  assertRanking({ 0, 1, 2 });                       // ties: earliest registration first
+
+  uint32_t v = g_leaderboardVersion;
+  TEST_ASSERT_TRUE(teamAddFound(g_teams[2], byId("B")));
+  TEST_ASSERT_EQUAL_INT(20, g_teams[2].points);
+  assertRanking({ 2, 0, 1 });
+  TEST_ASSERT_NOT_EQUAL(v, g_leaderboardVersion);
+
+  TEST_ASSERT_TRUE(teamAddFound(g_teams[1], byId("A")));
+  assertRanking({ 2, 1, 0 });
+  TEST_ASSERT_FALSE(teamAddFound(g_teams[1], byId("A")));   // second find of the same checkpoint
+  TEST_ASSERT_EQUAL_INT(10, g_teams[1].points);
+
+  TEST_ASSERT_TRUE(teamAddFound(g_teams[0], byId("Z")));    // zero points: no move
+  assertRanking({ 2, 1, 0 });
+
+  TEST_ASSERT_TRUE(teamAddFound(g_teams[0], byId("B")));    // passes team 1, ties team 2 but registered first
+  assertRanking({ 0, 2, 1 });
+
+  // Incremental order matches a full rebuild
+  std::vector<uint16_t> live = teamRanking();
+  rebuildRanking();
+  assertRanking(live);
+}
+
+static void test_team_finds_since(void) {
+  std::vector<Checkpoint> chk;
+  char id[8];
+  for (int i = 0; i < RECENT_FINDS + 3; i++) {
+    snprintf(id, sizeof(id), "C%d", i);
+    chk.push_back(checkpoint(id, id, 1, (uint16_t)i));
+  }
+  smallGame(chk, 1);
+  Team& t = g_teams[0];
+  uint16_t out[RECENT_FINDS];
+
+  TEST_ASSERT_EQUAL_INT(0, teamFindsSince(t, 0, out));      // nothing found, nothing new
+  TEST_ASSERT_EQUAL_INT(-1, teamFindsSince(t, 1, out));     // ahead of the team
+  TEST_ASSERT_EQUAL_INT(-1, teamFindsSince(t, -1, out));
+
+  // Finds loaded from a snapshot are not in the ring
+  t.found.set(0);
+  updatePointsFromFound(t);
+  TEST_ASSERT_EQUAL_INT(0, teamFindsSince(t, 1, out));
+  TEST_ASSERT_EQUAL_INT(-1, teamFindsSince(t, 0, out));
+
+  for (int i = 1; i <= RECENT_FINDS + 1; i++) teamAddFound(t, g_checkpoints[i]);
+  int n = t.found.count();                                  // RECENT_FINDS + 2
+  TEST_ASSERT_EQUAL_INT(2, teamFindsSince(t, n - 2, out));
+  TEST_ASSERT_EQUAL_UINT16(RECENT_FINDS, out[0]);           // oldest first
+  TEST_ASSERT_EQUAL_UINT16(RECENT_FINDS + 1, out[1]);
+  TEST_ASSERT_EQUAL_INT(RECENT_FINDS, teamFindsSince(t, n - RECENT_FINDS, out));
+  TEST_ASSERT_EQUAL_INT(-1, teamFindsSince(t, n - RECENT_FINDS - 1, out));   // ring overwritten
+
+  // A find whose checkpoint was removed since can't be replayed
+  t.found.clear(RECENT_FINDS + 1);
+  t.found.set(RECENT_FINDS + 2);                            // same count, different bits
+  TEST_ASSERT_EQUAL_INT(-1, teamFindsSince(t, n - 1, out));
+}
+
+static void test_replace_checkpoints_slots(void) {
+  smallGame({ checkpoint("A", "alpha", 10, 0), checkpoint("B", "bravo", 20, 1),
+              checkpoint("C", "charlie", 30, 2) }, 2);
+  teamAddFound(g_teams[0], byId("A"));
+  teamAddFound(g_teams[0], byId("B"));
+  teamAddFound(g_teams[1], byId("C"));
+
+  // Drop A, keep B (now at a new position and worth 5), keep C, add D
+  std::vector<Checkpoint> next = { checkpoint("D", "delta", 40, NO_SLOT), checkpoint("B", "bravo", 5, NO_SLOT),
+                                   checkpoint("C", "charlie", 30, NO_SLOT) };
+  replaceCheckpoints(next);
+  TEST_ASSERT_EQUAL_UINT32(3, g_checkpoints.size());
+  TEST_ASSERT_EQUAL_UINT16(1, byId("B").slot);              // kept
+  TEST_ASSERT_EQUAL_UINT16(2, byId("C").slot);
+  TEST_ASSERT_EQUAL_UINT16(0, byId("D").slot);              // A's slot, reused
+  TEST_ASSERT_NULL(findCheckpointById(String("A")));
+
+  // A's bit was cleared, so D isn't "found" by whoever found A
+  TEST_ASSERT_FALSE(teamFoundHas(g_teams[0], byId("D")));
+  TEST_ASSERT_TRUE(teamFoundHas(g_teams[0], byId("B")));
+  TEST_ASSERT_TRUE(teamFoundHas(g_teams[1], byId("C")));
+  TEST_ASSERT_EQUAL_INT(5, g_teams[0].points);              // rescored
+  TEST_ASSERT_EQUAL_INT(30, g_teams[1].points);
+  assertRanking({ 1, 0 });
+  TEST_ASSERT_NOT_NULL(findCheckpointByToken(" DELTA "));
+  TEST_ASSERT_NULL(findCheckpointByToken("alpha"));
+
+  // Empty table: every slot goes
+  std::vector<Checkpoint> none;
+  replaceCheckpoints(none);
+  TEST_ASSERT_EQUAL_UINT32(0, g_checkpoints.size());
+  TEST_ASSERT_EQUAL_INT(0, g_teams[0].found.count());
+  TEST_ASSERT_EQUAL_INT(0, g_teams[1].found.count());
+  TEST_ASSERT_EQUAL_INT(0, g_teams[0].points);
+}
+
+static void test_checkpoints_digest(void) {
+  smallGame({ checkpoint("A", "alpha", 10, 0), checkpoint("B", "bravo", 20, 1) }, 0);
+  uint32_t d = g_checkpointsDigest;
+
+  // Same content, other slots (as after a reload)
+  smallGame({ checkpoint("A", "alpha", 10, 7), checkpoint("B", "bravo", 20, 3) }, 0);
+  TEST_ASSERT_EQUAL_UINT32(d, g_checkpointsDigest);
+  // Codewords are not player-visible
+  smallGame({ checkpoint("A", "other", 10, 0), checkpoint("B", "bravo", 20, 1) }, 0);
+  TEST_ASSERT_EQUAL_UINT32(d, g_checkpointsDigest);
+
+  smallGame({ checkpoint("A", "alpha", 11, 0), checkpoint("B", "bravo", 20, 1) }, 0);
+  TEST_ASSERT_NOT_EQUAL(d, g_checkpointsDigest);
+  smallGame({ checkpoint("B", "bravo", 20, 1), checkpoint("A", "alpha", 10, 0) }, 0);
+  TEST_ASSERT_NOT_EQUAL(d, g_checkpointsDigest);
+  Checkpoint renamed = checkpoint("A", "alpha", 10, 0);
+  renamed.name = "Gate";
+  smallGame({ renamed, checkpoint("B", "bravo", 20, 1) }, 0);
+  TEST_ASSERT_NOT_EQUAL(d, g_checkpointsDigest);
+}
+
+static void test_snapshot_rejects_damage(void) {
+  smallGame({ checkpoint("A", "alpha", 10, 0), checkpoint("B", "bravo", 20, 1) }, 0);
+  std::vector<uint8_t> good;
+  encodeCheckpointsSnapshot(good, 41);
+  SnapshotInfo info;
+  TEST_ASSERT_TRUE(snapshotInfo(good.data(), good.size(), info));
+  TEST_ASSERT_EQUAL_UINT32(41, info.seq);
+  TEST_ASSERT_EQUAL_UINT32(good.size() - info.header_len, info.len);
+
+  std::vector<uint8_t> buf = good;
+  TEST_ASSERT_TRUE(decodeCheckpointsSnapshot(buf));
+  TEST_ASSERT_EQUAL_UINT32(2, g_checkpoints.size());
+  TEST_ASSERT_EQUAL_STRING("bravo", g_checkpoints[1].token_text.c_str());
+
+  // Any damage leaves the current table alone
+  g_checkpoints.clear();
+  buf = good; buf[buf.size() - 3] ^= 0x40;                   // payload: CRC mismatch
+  TEST_ASSERT_FALSE(decodeCheckpointsSnapshot(buf));
+  buf = good; buf.pop_back();                                // truncated
+  TEST_ASSERT_FALSE(decodeCheckpointsSnapshot(buf));
+  buf = good; buf[4] = 9;                                    // unknown version
+  TEST_ASSERT_FALSE(snapshotInfo(buf.data(), buf.size(), info));
+  TEST_ASSERT_FALSE(decodeCheckpointsSnapshot(buf));
+  buf = good; buf[0] ^= 1;                                   // magic
+  TEST_ASSERT_FALSE(decodeCheckpointsSnapshot(buf));
+  encodeTeamsSnapshot(buf);                                  // other kind
+  TEST_ASSERT_FALSE(decodeCheckpointsSnapshot(buf));
+  TEST_ASSERT_EQUAL_UINT32(0, g_checkpoints.size());
+
+  // A damaged sequence only ranks the copy last; the payload still loads
+  buf = good; buf[20] ^= 1;
+  TEST_ASSERT_TRUE(snapshotInfo(buf.data(), buf.size(), info));
+  TEST_ASSERT_EQUAL_UINT32(0, info.seq);
+  TEST_ASSERT_TRUE(decodeCheckpointsSnapshot(buf));
+}
+
+// ------------------ Benchmarks ------------------
+
+static void benchTokenLookup(size_t teams, size_t chk) {
+  const uint32_t ops = 2000;
+  char queries[16][80];
+  for (int q = 0; q < 16; q++) {   // mixed case + padding, as typed on a phone
+    snprintf(queries[q], sizeof(queries[q]), "  shiver ME timbers %u ", (unsigned)(rnd() % chk));
+  }
+  uint32_t hits = 0;
+  Measure m;
+  for (uint32_t i = 0; i < ops; i++) {
+    const char* q = queries[i & 15];
+    if (findCheckpointByToken(q, strlen(q))) hits++;
+  }
+  m.report("token_lookup", teams, chk, ops);
+  TEST_ASSERT_EQUAL_UINT32(ops, hits);
+}
+
+static void benchUpdatePoints(size_t teams, size_t chk) {
+  std::vector<int> before;
+  for (auto &t : g_teams) before.push_back(t.points);
+  Measure m;
+  for (auto &t : g_teams) updatePointsFromFound(t);
+  m.report("update_points", teams, chk, (uint32_t)g_teams.size());
+  for (size_t i = 0; i < g_teams.size(); i++) TEST_ASSERT_EQUAL_INT(before[i], g_teams[i].points);
+}
+
+static void benchLeaderboard(size_t teams, size_t chk) {
+  const uint32_t ops = 20;
+  static char out[4096];
+  size_t len = 0;
+  Measure m;
+  for (uint32_t i = 0; i < ops; i++) {
+    rebuildRanking();
+    JsonDocument d;
+    leaderboardToJson(d["teams"].to<JsonArray>());
+    len = serializeJson(d, out, sizeof(out));
+  }
+  char extra[32]; snprintf(extra, sizeof(extra), "json=%uB", (unsigned)len);
+  m.report("leaderboard_build", teams, chk, ops, extra);
+}
+
+static void benchSnapshotRoundTrip(size_t teams, size_t chk) {
+  std::vector<int> before;
+  for (auto &t : g_teams) before.push_back(t.points);
+  std::vector<uint8_t> buf;
+  size_t bytes = 0;
+  bool ok = true;
+  const uint32_t ops = 5;
+  Measure m;
+  for (uint32_t i = 0; i < ops; i++) {
+    encodeTeamsSnapshot(buf);
+    bytes = buf.size();
+    ok = decodeTeamsSnapshot(buf) && ok;
+  }
+  char extra[32]; snprintf(extra, sizeof(extra), "snapshot=%uB", (unsigned)bytes);
+  m.report("teams_roundtrip", teams, chk, ops, extra);
+  TEST_ASSERT_TRUE(ok);
+  TEST_ASSERT_EQUAL_UINT32(before.size(), g_teams.size());
+  for (size_t i = 0; i < g_teams.size(); i++) {
+    updatePointsFromFound(g_teams[i]);
+    TEST_ASSERT_EQUAL_INT(before[i], g_teams[i].points);
+  }
+}
+
+// Same document shape as /api/admin/teams, serialized the way sendJSON does
+static void benchSerializeTeams(size_t teams, size_t chk) {
+  const uint32_t ops = 5;
+  size_t len = 0;
+  Measure m;
+  for (uint32_t i = 0; i < ops; i++) {
+    JsonDocument d;
+    JsonArray arr = d["teams"].to<JsonArray>();
+    for (auto &t : g_teams) {
+      JsonObject o = arr.add<JsonObject>();
+      o["id"] = t.id.c_str();
+      o["name"] = t.name.c_str();
+      o["points"] = t.points;
+      o["found"] = t.found.count();
+      o["created_at"] = t.created_at;
+    }
+    std::vector<char> out(measureJson(d) + 1);
+    len = serializeJson(d, out.data(), out.size());
+  }
+  char extra[32]; snprintf(extra, sizeof(extra), "json=%uB", (unsigned)len);
+  m.report("serialize_teams", teams, chk, ops, extra);
+}
+
+static bool fitsOnHeap(size_t teams) {
+#ifdef ARDUINO
+  // Team + its heap strings is ~0.25 KB; the round trip briefly holds two copies
+  size_t need = teams * 2 * 256 + 16384;
+  if (ESP.getFreeHeap() < need) {
+    printf("[bench] teams=%u skipped: needs ~%u KB, %u KB free\n",
+           (unsigned)teams, (unsigned)(need / 1024), (unsigned)(ESP.getFreeHeap() / 1024));
+    return false;
+  }
+#endif
+  (void)teams;
+  return true;
+}
+
+static void test_engine_benchmarks(void) {
+  static const size_t TEAMS[] = { 10, 100, 500 };
+  static const size_t CHECKPOINTS[] = { 20, 200 };
+  for (size_t teams : TEAMS) {
+    if (!fitsOnHeap(teams)) continue;
+    for (size_t chk : CHECKPOINTS) {
+      buildGame(teams, chk);
+      benchTokenLookup(teams, chk);
+      benchUpdatePoints(teams, chk);
+      benchLeaderboard(teams, chk);
+      benchSnapshotRoundTrip(teams, chk);
+      benchSerializeTeams(teams, chk);
+    }
+  }
+  g_checkpoints.clear(); g_checkpoints.shrink_to_fit();
+  g_teams.clear(); g_teams.shrink_to_fit();
+}
+
+static int runTests() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ranking_after_find);
+  RUN_TEST(test_team_finds_since);
+  RUN_TEST(test_replace_checkpoints_slots);
+  RUN_TEST(test_checkpoints_digest);
+  RUN_TEST(test_snapshot_rejects_damage);
+  RUN_TEST(test_engine_benchmarks);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+  delay(2000);   // let the test runner attach to the serial port
+  runTests();
+}
+void loop() {}
+#else
+int main() {
+  return runTests();
+}
+#endif
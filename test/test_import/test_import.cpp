@@ -0,0 +1,216 @@
+// Bulk checkpoint import parser (lib/engine): line splitting across chunks,
+// CSV headers (also after a BOM or blank lines), duplicate and malformed ids,
+// repeated codewords, and when a result may be installed.
+//
+//   host:  pio test -e native_unit -f test_import
+
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "engine.h"
+
+// Stand-in for main.cpp's makeCheckpoint(): a codeword is required, the id defaults
+static int g_autoId = 0;
+static bool makeForTest(const char* id, const char* name, const char* token, int points, Checkpoint& c) {
+  if (!*token) return false;
+  char buf[16];
+  if (!*id) { snprintf(buf, sizeof(buf), "C%d", ++g_autoId); id = buf; }
+  c.id = id;
+  c.name = name;
+  c.token_text = token;
+  c.points = points;
+  return true;
+}
+
+// Feed `body` in pieces of `chunk` bytes, as the upload handler would
+static void runImport(CheckpointImport& im, const char* body, size_t chunk) {
+  JsonDocument scratch;
+  im.make = makeForTest;
+  size_t len = strlen(body);
+  for (size_t at = 0; at < len; at += chunk) {
+    size_t n = (len - at < chunk) ? len - at : chunk;
+    importFeed(im, (const uint8_t*)body + at, n, scratch);
+  }
+  importFinish(im, scratch);
+}
+
+void setUp(void) { g_autoId = 0; }
+void tearDown(void) {}
+
+static void test_ndjson_split_across_chunks(void) {
+  const char* body =
+    "{\"id\":\"a\",\"name\":\"Gate\",\"token_text\":\"open sesame\",\"points\":5}\r\n"
+    "\n"
+    "{\"name\":\"Well\",\"token_text\":\"deep water\"}";   // no trailing newline
+  CheckpointImport im;
+  runImport(im, body, 7);
+  TEST_ASSERT_EQUAL_UINT32(BULK_NDJSON, im.fmt);
+  TEST_ASSERT_EQUAL_UINT32(2, im.next.size());
+  TEST_ASSERT_EQUAL_UINT32(0, im.rejected);
+  TEST_ASSERT_EQUAL_STRING("a", im.next[0].id.c_str());
+  TEST_ASSERT_EQUAL_INT(5, im.next[0].points);
+  TEST_ASSERT_EQUAL_STRING("C1", im.next[1].id.c_str());
+  TEST_ASSERT_EQUAL_INT(10, im.next[1].points);   // default
+  TEST_ASSERT_TRUE(importInstallable(im, false, false));
+}
+
+static void test_csv_header_maps_columns(void) {
+  const char* body =
+    "points,token_text,name\n"
+    "3,\"red, green\",\"Say \"\"hi\"\"\"\n"
+    ",blue,Sky\n";
+  CheckpointImport im;
+  runImport(im, body, 1);
+  TEST_ASSERT_EQUAL_UINT32(BULK_CSV, im.fmt);
+  TEST_ASSERT_EQUAL_UINT32(2, im.next.size());
+  TEST_ASSERT_EQUAL_STRING("red, green", im.next[0].token_text.c_str());
+  TEST_ASSERT_EQUAL_STRING("Say \"hi\"", im.next[0].name.c_str());
+  TEST_ASSERT_EQUAL_INT(3, im.next[0].points);
+  TEST_ASSERT_EQUAL_INT(10, im.next[1].points);
+}
+
+// Spreadsheet exports often start with a UTF-8 BOM; it must not hide the
+// header's first column name (chunk of 1 splits the BOM itself)
+static void test_csv_bom_stripped(void) {
+  const char* body =
+    "\xEF\xBB\xBFid,token_text,name\n"
+    "a,red,Sky\n";
+  CheckpointImport im;
+  runImport(im, body, 1);
+  TEST_ASSERT_EQUAL_UINT32(BULK_CSV, im.fmt);
+  TEST_ASSERT_EQUAL_UINT32(1, im.next.size());
+  TEST_ASSERT_EQUAL_UINT32(0, im.rejected);
+  TEST_ASSERT_EQUAL_STRING("a", im.next[0].id.c_str());
+  TEST_ASSERT_EQUAL_STRING("red", im.next[0].token_text.c_str());
+}
+
+// The header is the first non-blank record, not necessarily line 1
+static void test_csv_header_after_blank_lines(void) {
+  const char* body =
+    "\r\n"
+    "  \n"
+    "points,token_text,name\n"
+    "3,blue,Sky\n";
+  CheckpointImport im;
+  runImport(im, body, 64);
+  TEST_ASSERT_EQUAL_UINT32(1, im.next.size());
+  TEST_ASSERT_EQUAL_UINT32(0, im.rejected);
+  TEST_ASSERT_EQUAL_STRING("blue", im.next[0].token_text.c_str());
+  TEST_ASSERT_EQUAL_STRING("Sky", im.next[0].name.c_str());
+  TEST_ASSERT_EQUAL_INT(3, im.next[0].points);
+}
+
+static void test_duplicate_id_rejected(void) {
+  const char* body =
+    "a,One,first\n"
+    "b,Two,second\n"
+    "a,Three,third\n";
+  CheckpointImport im;
+  runImport(im, body, 64);
+  TEST_ASSERT_EQUAL_UINT32(2, im.next.size());
+  TEST_ASSERT_EQUAL_UINT32(1, im.rejected);
+  TEST_ASSERT_EQUAL_UINT32(3, im.firstRejected);
+}
+
+static void test_duplicate_token_rejected_case_folded(void) {
+  const char* body =
+    "a,One,Open Sesame\n"
+    "b,Two,  open sesame \n"
+    "c,Three,OPEN SESAME\n"
+    "d,Four,closed\n";
+  CheckpointImport im;
+  runImport(im, body, 64);
+  TEST_ASSERT_EQUAL_UINT32(2, im.next.size());
+  TEST_ASSERT_EQUAL_STRING("a", im.next[0].id.c_str());
+  TEST_ASSERT_EQUAL_STRING("d", im.next[1].id.c_str());
+  TEST_ASSERT_EQUAL_UINT32(2, im.rejected);
+  TEST_ASSERT_EQUAL_UINT32(2, im.firstRejected);
+}
+
+// Ids reach the tab-separated team journal: control characters, tabs,
+// spaces and overlong ids are refused even if `make` accepts them
+static void test_bad_ids_rejected(void) {
+  const char* body =
+    "ok-1.a_B,One,first\n"
+    "\"a\tb\",Two,second\n"
+    "\"a\x01\",Three,third\n"
+    "a b,Four,fourth\n"
+    "abcdefghijklmnopqrstuvwxyz0123456,Five,fifth\n"   // ID_MAXLEN + 1
+    "abcdefghijklmnopqrstuvwxyz012345,Six,sixth\n";
+  CheckpointImport im;
+  runImport(im, body, 64);
+  TEST_ASSERT_EQUAL_UINT32(2, im.next.size());
+  TEST_ASSERT_EQUAL_STRING("ok-1.a_B", im.next[0].id.c_str());
+  TEST_ASSERT_EQUAL_STRING("Six", im.next[1].name.c_str());
+  TEST_ASSERT_EQUAL_UINT32(4, im.rejected);
+  TEST_ASSERT_EQUAL_UINT32(2, im.firstRejected);
+  TEST_ASSERT_FALSE(saneCheckpointId(String("")));
+}
+
+static void test_bad_and_overlong_lines_rejected(void) {
+  char body[IMPORT_LINE_MAX + 128];
+  size_t n = 0;
+  n += snprintf(body + n, sizeof(body) - n, "{\"token_text\":\"ok\"}\n");
+  n += snprintf(body + n, sizeof(body) - n, "{not json\n");
+  body[n++] = '{';
+  for (int i = 0; i < IMPORT_LINE_MAX + 8; i++) body[n++] = 'x';
+  body[n] = 0;   // overlong last line, no newline
+  CheckpointImport im;
+  runImport(im, body, 16);
+  TEST_ASSERT_EQUAL_UINT32(1, im.next.size());
+  TEST_ASSERT_EQUAL_UINT32(2, im.rejected);
+  TEST_ASSERT_EQUAL_UINT32(2, im.firstRejected);
+}
+
+static void test_installable_policy(void) {
+  CheckpointImport clean;
+  runImport(clean, "a,One,first\n", 64);
+  TEST_ASSERT_TRUE(importInstallable(clean, false, false));
+
+  // Some lines rejected: only on request
+  CheckpointImport partial;
+  runImport(partial, "a,One,first\n,,\n", 64);
+  TEST_ASSERT_EQUAL_UINT32(1, partial.rejected);
+  TEST_ASSERT_FALSE(importInstallable(partial, false, false));
+  TEST_ASSERT_TRUE(importInstallable(partial, true, false));
+  TEST_ASSERT_TRUE(importInstallable(partial, false, true));
+
+  // Everything rejected, or nothing at all: would wipe the table
+  CheckpointImport allBad;
+  runImport(allBad, "a,One,\nb,Two,\n", 64);
+  TEST_ASSERT_EQUAL_UINT32(0, allBad.next.size());
+  TEST_ASSERT_FALSE(importInstallable(allBad, false, false));
+  TEST_ASSERT_FALSE(importInstallable(allBad, true, false));
+  TEST_ASSERT_TRUE(importInstallable(allBad, false, true));
+
+  CheckpointImport empty;
+  runImport(empty, "\n\n", 64);
+  TEST_ASSERT_EQUAL_UINT32(0, empty.rejected);
+  TEST_ASSERT_FALSE(importInstallable(empty, true, false));
+  TEST_ASSERT_TRUE(importInstallable(empty, false, true));
+}
+
+static int runTests() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ndjson_split_across_chunks);
+  RUN_TEST(test_csv_header_maps_columns);
+  RUN_TEST(test_csv_bom_stripped);
+  RUN_TEST(test_csv_header_after_blank_lines);
+  RUN_TEST(test_duplicate_id_rejected);
+  RUN_TEST(test_duplicate_token_rejected_case_folded);
+  RUN_TEST(test_bad_ids_rejected);
+  RUN_TEST(test_bad_and_overlong_lines_rejected);
+  RUN_TEST(test_installable_policy);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+void setup() {
+  delay(2000);   // let the test runner attach to the serial port
+  runTests();
+}
+void loop() {}
+#else
+int main() { return runTests(); }
+#endif
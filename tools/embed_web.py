@@ -0,0 +1,66 @@
+"""
+Gzip the portal pages in web/ into include/web_assets.h.
+
+Runs as a PlatformIO pre-build script (see extra_scripts in platformio.ini)
+and can also be run by hand: `python tools/embed_web.py`.
+
+Each asset becomes a PROGMEM byte array that the firmware streams straight
+from flash with `Content-Encoding: gzip`.
+"""
+import gzip
+import os
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+OUT = os.path.join(PROJECT_DIR, "include", "web_assets.h")
+
+# source file -> C symbol prefix
+ASSETS = [
+    ("app.html", "WEB_APP_HTML"),
+    ("admin.html", "WEB_ADMIN_HTML"),
+    ("captive.html", "WEB_CAPTIVE_HTML"),
+    ("sw.js", "WEB_SW_JS"),
+    ("manifest.webmanifest", "WEB_MANIFEST"),
+]
+
+
+def c_array(sym, data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ",".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+    return (
+        "static const uint8_t %s_GZ[] PROGMEM = {\n%s\n};\n"
+        "static const size_t %s_GZ_LEN = %d;\n" % (sym, "\n".join(lines), sym, len(data))
+    )
+
+
+def build():
+    parts = [
+        "// Generated by tools/embed_web.py from web/ -- do not edit.\n",
+        "#pragma once\n#include <Arduino.h>\n\n",
+    ]
+    for name, sym in ASSETS:
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            raw = f.read()
+        # mtime=0 keeps the output byte-identical for unchanged sources
+        gz = gzip.compress(raw, compresslevel=9, mtime=0)
+        parts.append("// %s: %d -> %d bytes\n" % (name, len(raw), len(gz)))
+        parts.append(c_array(sym, gz) + "\n")
+    text = "".join(parts)
+
+    old = None
+    if os.path.exists(OUT):
+        with open(OUT, "r") as f:
+            old = f.read()
+    if old != text:  # avoid touching the header (and rebuilding) when nothing changed
+        with open(OUT, "w") as f:
+            f.write(text)
+        print("[embed_web] wrote %s" % os.path.relpath(OUT, PROJECT_DIR))
+
+
+build()
@@ -0,0 +1,43 @@
+const CACHE = 'scv-v4';
+self.addEventListener('install', e => {
+  e.waitUntil(caches.open(CACHE).then(c => c.addAll(['/app','/api/items'])));
+  self.skipWaiting();
+});
+self.addEventListener('activate', e => {
+  e.waitUntil(
+    caches.keys().then(keys => Promise.all(keys.filter(k => k !== CACHE).map(k => caches.delete(k))))
+  );
+  self.clients.claim();
+});
+
+// Cache-first, then revalidate with the cached ETag: an unchanged page or
+// item list costs one 304 and the next load picks up whatever changed.
+function revalidate(path, cached) {
+  const headers = {};
+  const etag = cached && cached.headers.get('ETag');
+  if (etag) headers['If-None-Match'] = etag;
+  return fetch(path, { headers, cache: 'no-store' }).then(r => {
+    if (r.status === 304 && cached) return cached;
+    if (r.ok) {
+      const cc = r.clone();
+      caches.open(CACHE).then(c => c.put(path, cc));
+    }
+    return r;
+  });
+}
+
+self.addEventListener('fetch', e => {
+  const u = new URL(e.request.url);
+  if (e.request.method !== 'GET') return;
+  if (u.pathname === '/api/items' || u.pathname === '/app') {
+    e.respondWith(
+      caches.match(u.pathname).then(cached => {
+        const fresh = revalidate(u.pathname, cached);
+        if (!cached) return fresh;
+        e.waitUntil(fresh.catch(() => {}));
+        return cached;
+      })
+    );
+    return;
+  }
+});